@@ -4,150 +4,2365 @@
 #include "bf/bf.h"
 #include "bf/exceptions.h"
 
+#include <map>
+#include <memory>
 #include <stack>
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
 #include <limits>
+#include <optional>
+#include <set>
 #include <stdexcept>
+#include <string>
+#include <utility>
 
 using namespace Brainfreeze;
 using namespace Brainfreeze::Helpers;
 
+namespace
+{
+    /** Details for each compiler pass. */
+    struct pass_info_t
+    {
+        CompilerPass pass;
+        const char* name;
+        const char* description;
+        int level;          ///< Lowest optimization level that enables the pass.
+    };
+
+    /** Table of compiler passes, indexed by pass. */
+    const std::array<pass_info_t, CompilerPassCount> GPassTable
+    {
+        pass_info_t { CompilerPass::MergeRuns, "merge-runs", "Merge runs of +, -, > and < into one instruction", 1 },
+        pass_info_t { CompilerPass::CancelRuns, "cancel-runs", "Replace runs like +-+ and <>> with the net change", 1 },
+        pass_info_t { CompilerPass::DeadLoops, "dead-loops", "Remove loops that start on a cell known to be zero", 1 },
+        pass_info_t { CompilerPass::ClearLoops, "clear-loops", "Replace [-] and [+] with a store", 2 },
+        pass_info_t { CompilerPass::MultiplyLoops, "multiply-loops", "Replace loops like [->++<] with multiplies", 2 },
+        pass_info_t { CompilerPass::ClosedFormLoops, "closed-form-loops", "Replace nested multiply loops", 2 },
+        pass_info_t { CompilerPass::ScanLoops, "scan-loops", "Replace loops like [>] with a scan", 2 },
+        pass_info_t { CompilerPass::IfLoops, "if-loops", "Replace loops that run at most once with a skip", 2 },
+        pass_info_t { CompilerPass::OffsetAddressing, "offset-addressing", "Address cells relative to the pointer", 2 },
+        pass_info_t { CompilerPass::ConstantPropagation, "const-prop", "Simplify code using known cell values", 2 },
+        pass_info_t { CompilerPass::PartialEvaluation, "partial-eval", "Run the program up to its first read", 3 },
+        pass_info_t { CompilerPass::FoldConstantOutput, "fold-output", "Print output known when compiling at once", 2 },
+        pass_info_t { CompilerPass::LinkJumps, "link-jumps", "Store the distance to the matching jump in jumps", 1 },
+    };
+
+    /**
+     * A cell's value at the end of a loop iteration as a sum of multiples of the cell values at the start of the
+     * iteration plus a constant. Arithmetic wraps around like the 8 bit cells the values are stored in.
+     */
+    struct affine_t
+    {
+        std::map<int, uint8_t> factors;     ///< Multiple of each cell's starting value, keyed by cell position.
+        uint8_t constant = 0;
+
+        /** Add a multiple of another value to this one. */
+        void add(const affine_t& other, int multiple)
+        {
+            for (const auto& [cell, factor] : other.factors)
+            {
+                if (auto& sum = factors[cell]; (sum = static_cast<uint8_t>(sum + factor * multiple)) == 0)
+                {
+                    factors.erase(cell);
+                }
+            }
+
+            constant = static_cast<uint8_t>(constant + other.constant * multiple);
+        }
+    };
+
+    /**
+     * Follow one iteration of a loop whose body is straight line code at compile time and get the value of each cell
+     * it changes, keyed by position relative to the loop cell. Returns nothing if the body contains anything other
+     * than pointer movement and cell arithmetic or does not return the pointer to the loop cell.
+     */
+    std::optional<std::map<int, affine_t>> FollowIteration(
+        const std::vector<instruction_t>& instructions,
+        size_t start,
+        size_t end)
+    {
+        std::map<int, affine_t> cells;
+        int position = 0;
+
+        auto valueOf = [&](int cell) {
+            if (auto itr = cells.find(cell); itr != cells.end())
+            {
+                return itr->second;
+            }
+
+            affine_t unchanged;
+            unchanged.factors[cell] = 1;
+            return unchanged;
+        };
+
+        for (size_t i = start + 1; i < end; ++i)
+        {
+            const auto& instr = instructions[i];
+            const int cell = position + instr.offset();
+
+            switch (instr.opcode())
+            {
+            case OpcodeType::PtrInc:
+                position += instr.param();
+                break;
+
+            case OpcodeType::PtrDec:
+                position -= instr.param();
+                break;
+
+            case OpcodeType::MemInc:
+            case OpcodeType::MemDec:
+            {
+                auto value = valueOf(cell);
+                value.constant = static_cast<uint8_t>(
+                    value.constant + (instr.isA(OpcodeType::MemInc) ? instr.param() : -instr.param()));
+                cells[cell] = value;
+                break;
+            }
+
+            case OpcodeType::SetZero:
+            case OpcodeType::SetValue:
+                cells[cell] = affine_t{ {}, static_cast<uint8_t>(instr.param()) };
+                break;
+
+            case OpcodeType::MulAdd:
+            {
+                auto value = valueOf(cell);
+                value.add(valueOf(position), instr.param());
+                cells[cell] = value;
+                break;
+            }
+
+            default:
+                return std::nullopt;
+            }
+        }
+
+        if (position != 0)
+        {
+            return std::nullopt;
+        }
+
+        return cells;
+    }
+
+    /** What is known about a loop's body by following it at compile time. */
+    struct loop_shape_t
+    {
+        size_t end = 0;                 ///< Index of the loop's ].
+        bool isBalanced = false;        ///< Each pass through the body leaves the pointer where it started.
+        bool clearsLoopCell = false;    ///< Each pass through the body leaves the loop cell zero.
+    };
+
+    /**
+     * Follow the body of the loop starting at `start` to find where it leaves the pointer and whether the loop cell
+     * is always zero at the end. Nested loops always stop on a zero cell, so a balanced nested loop on the loop cell
+     * clears it. Anything the body does with an unknown pointer makes the rest of the body unknown.
+     */
+    loop_shape_t AnalyzeLoop(const std::vector<instruction_t>& instructions, size_t start)
+    {
+        assert(instructions[start].isA(OpcodeType::JumpForward));
+
+        int position = 0;
+        bool isPositionKnown = true;
+        bool isLoopCellZero = false;
+        size_t i = start + 1;
+
+        for (; !instructions[i].isA(OpcodeType::JumpBack); ++i)
+        {
+            const auto& instr = instructions[i];
+            const bool isLoopCell = isPositionKnown && position + instr.offset() == 0;
+
+            switch (instr.opcode())
+            {
+            case OpcodeType::PtrInc:
+            case OpcodeType::PtrDec:
+                position += (instr.isA(OpcodeType::PtrInc) ? instr.param() : -instr.param());
+                break;
+
+            case OpcodeType::JumpForward:
+            {
+                auto inner = AnalyzeLoop(instructions, i);
+                i = inner.end;
+
+                if (inner.isBalanced)
+                {
+                    isLoopCellZero = (isPositionKnown && position == 0);
+                }
+                else
+                {
+                    isPositionKnown = false;
+                    isLoopCellZero = false;
+                }
+                break;
+            }
+
+            case OpcodeType::ScanRight:
+            case OpcodeType::ScanLeft:
+                isPositionKnown = false;
+                isLoopCellZero = false;
+                break;
+
+            case OpcodeType::SetZero:
+                isLoopCellZero = (isLoopCellZero || isLoopCell);
+                break;
+
+            case OpcodeType::NoOperation:
+            case OpcodeType::Write:
+                break;
+
+            default:
+                // Anything else may change the cell it addresses.
+                isLoopCellZero = (isLoopCellZero && isPositionKnown && !isLoopCell);
+                break;
+            }
+        }
+
+        const bool isBalanced = (isPositionKnown && position == 0);
+        return { i, isBalanced, isBalanced && isLoopCellZero };
+    }
+
+    /**
+     * What is known about the value of each cell at one point in a program. Cells are keyed by their position
+     * relative to where the memory pointer was when tracking started. Cells without an entry are zero if every other
+     * cell is known to be zero, and unknown otherwise.
+     */
+    struct known_cells_t
+    {
+        std::map<int, std::optional<int8_t>> cells;
+        bool areOtherCellsZero = true;
+
+        /** Get the value of a cell, or nothing if it is not known. */
+        std::optional<int8_t> at(int address) const
+        {
+            auto itr = cells.find(address);
+            return itr != cells.end() ? itr->second : (areOtherCellsZero ? std::optional<int8_t>(0) : std::nullopt);
+        }
+
+        /** Forget the value of every cell. */
+        void forget()
+        {
+            cells.clear();
+            areOtherCellsZero = false;
+        }
+
+        /** Keep only the values that are the same here and in another state, for where two paths join. */
+        void meet(const known_cells_t& other)
+        {
+            std::map<int, std::optional<int8_t>> joined;
+
+            auto join = [&](int address) {
+                auto value = at(address);
+                joined[address] = (value == other.at(address) ? value : std::nullopt);
+            };
+
+            for (const auto& entry : cells)
+            {
+                join(entry.first);
+            }
+
+            for (const auto& entry : other.cells)
+            {
+                join(entry.first);
+            }
+
+            cells = std::move(joined);
+            areOtherCellsZero = (areOtherCellsZero && other.areOtherCellsZero);
+        }
+    };
+
+    /**
+     * Find every cell a loop may change, relative to the loop cell. Cells that are not in the set keep their value
+     * inside the loop and after it exits. Returns nothing if the body moves the pointer by an amount that can not be
+     * followed at compile time, since then it may change any cell.
+     */
+    std::optional<std::set<int>> FindLoopWrites(const std::vector<instruction_t>& instructions, size_t start)
+    {
+        assert(instructions[start].isA(OpcodeType::JumpForward));
+
+        std::set<int> writes;
+        std::stack<int> blockPositions;
+        int position = 0;
+
+        for (size_t i = start + 1;; ++i)
+        {
+            const auto& instr = instructions[i];
+
+            switch (instr.opcode())
+            {
+            case OpcodeType::PtrInc:
+            case OpcodeType::PtrDec:
+                position += (instr.isA(OpcodeType::PtrInc) ? instr.param() : -instr.param());
+                break;
+
+            case OpcodeType::MemInc:
+            case OpcodeType::MemDec:
+            case OpcodeType::SetZero:
+            case OpcodeType::SetValue:
+            case OpcodeType::MulAdd:
+            case OpcodeType::ProductAdd:
+            case OpcodeType::Read:
+                writes.insert(position + instr.offset());
+                break;
+
+            case OpcodeType::JumpForward:
+            case OpcodeType::IfZeroSkip:
+                blockPositions.push(position);
+                break;
+
+            case OpcodeType::JumpBack:
+            case OpcodeType::EndIf:
+                // A nested block that does not return the pointer to where it started moves it by an unknown amount.
+                if (blockPositions.empty())
+                {
+                    return position == 0 ? std::optional<std::set<int>>(std::move(writes)) : std::nullopt;
+                }
+                else if (blockPositions.top() != position)
+                {
+                    return std::nullopt;
+                }
+
+                blockPositions.pop();
+                break;
+
+            case OpcodeType::NoOperation:
+            case OpcodeType::Write:
+            case OpcodeType::PrintString:
+                break;
+
+            default:
+                return std::nullopt;
+            }
+        }
+    }
+
+    /**
+     * Most cells available when running a program at compile time, even if the program is compiled for more. Programs
+     * that move past the cells they have are left for the interpreter to run.
+     */
+    constexpr size_t MaxPartialEvaluationCellCount = 1024 * 1024;
+
+    /** Append instructions that move the memory pointer by the given distance. */
+    void AppendPointerMove(std::vector<instruction_t>& output, int distance)
+    {
+        while (distance != 0)
+        {
+            auto amount = std::min(std::abs(distance), (int)std::numeric_limits<instruction_t::param_t>::max());
+            output.push_back(instruction_t(
+                distance > 0 ? OpcodeType::PtrInc : OpcodeType::PtrDec,
+                static_cast<instruction_t::param_t>(amount)));
+            distance += (distance > 0 ? -amount : amount);
+        }
+    }
+
+    /** Append PrintString instructions for the text, split across several if it is too long for one. */
+    void AppendPrintString(std::vector<instruction_t>& output, std::string_view text)
+    {
+        constexpr size_t MaxLength = (size_t)std::numeric_limits<instruction_t::param_t>::max();
+
+        for (; !text.empty(); text.remove_prefix(std::min(text.size(), MaxLength)))
+        {
+            auto length = std::min(text.size(), MaxLength);
+            output.push_back(instruction_t(OpcodeType::PrintString, static_cast<instruction_t::param_t>(length)));
+
+            for (size_t start = 0; start < length; start += instruction_t::StringBytesPerWord)
+            {
+                output.push_back(instruction_t::stringData(text.data() + start, length - start));
+            }
+        }
+    }
+
+    /** Memory, output and position of a program that was run at compile time. */
+    struct prefix_run_t
+    {
+        size_t ip = 0;
+        size_t steps = 0;
+        size_t pointer = 0;
+        std::vector<int8_t> tape;
+        std::string output;
+    };
+
+    /**
+     * Run instructions at compile time on a tape of `cellCount` cells until the program reads input, ends, runs for
+     * `maxSteps` instructions or is about to do something that would fail. `lastResumableStep` is updated with the
+     * number of steps executed the last time the program reached an instruction it can resume from.
+     */
+    prefix_run_t RunPrefix(
+        const std::vector<instruction_t>& instructions,
+        const std::vector<size_t>& partners,
+        const std::vector<bool>& resumable,
+        size_t cellCount,
+        size_t maxSteps,
+        size_t& lastResumableStep)
+    {
+        prefix_run_t run;
+        run.tape.resize(std::min(cellCount, MaxPartialEvaluationCellCount), 0);
+
+        auto isValid = [&](long long address) {
+            return address >= 0 && address < (long long)run.tape.size();
+        };
+
+        for (; run.steps < maxSteps && run.ip < instructions.size(); ++run.ip, ++run.steps)
+        {
+            if (resumable[run.ip])
+            {
+                lastResumableStep = run.steps;
+            }
+
+            const auto& instr = instructions[run.ip];
+            const auto address = (long long)run.pointer + instr.offset();
+            auto& cell = run.tape[run.pointer];
+
+            switch (instr.opcode())
+            {
+            case OpcodeType::PtrInc:
+            case OpcodeType::PtrDec:
+            {
+                auto target = (long long)run.pointer + (instr.isA(OpcodeType::PtrInc) ? instr.param() : -instr.param());
+
+                if (!isValid(target))
+                {
+                    return run;
+                }
+
+                run.pointer = (size_t)target;
+                break;
+            }
+
+            case OpcodeType::MemInc:
+            case OpcodeType::MemDec:
+            case OpcodeType::SetZero:
+            case OpcodeType::SetValue:
+                if (!isValid(address))
+                {
+                    return run;
+                }
+
+                if (instr.isA(OpcodeType::MemInc))
+                {
+                    run.tape[address] += static_cast<int8_t>(instr.param());
+                }
+                else if (instr.isA(OpcodeType::MemDec))
+                {
+                    run.tape[address] -= static_cast<int8_t>(instr.param());
+                }
+                else
+                {
+                    run.tape[address] = static_cast<int8_t>(instr.param());
+                }
+                break;
+
+            case OpcodeType::MulAdd:
+                if (cell != 0)
+                {
+                    if (!isValid(address))
+                    {
+                        return run;
+                    }
+
+                    run.tape[address] += static_cast<int8_t>(cell * instr.param());
+                }
+                break;
+
+            case OpcodeType::ProductAdd:
+                if (cell != 0)
+                {
+                    const auto source = (long long)run.pointer + instructions[run.ip + 1].offset();
+
+                    if (!isValid(address) || !isValid(source))
+                    {
+                        return run;
+                    }
+
+                    run.tape[address] += static_cast<int8_t>(cell * run.tape[source] * instr.param());
+                }
+                break;
+
+            case OpcodeType::ScanRight:
+            case OpcodeType::ScanLeft:
+            {
+                auto stride = (instr.isA(OpcodeType::ScanRight) ? instr.param() : -instr.param());
+                auto target = (long long)run.pointer;
+
+                while (isValid(target) && run.tape[target] != 0)
+                {
+                    target += stride;
+                }
+
+                if (!isValid(target))
+                {
+                    return run;
+                }
+
+                run.pointer = (size_t)target;
+                break;
+            }
+
+            case OpcodeType::Write:
+                if (!isValid(address))
+                {
+                    return run;
+                }
+
+                run.output.push_back(static_cast<char>(run.tape[address]));
+                break;
+
+            case OpcodeType::JumpForward:
+                run.ip = (cell == 0 ? partners[run.ip] : run.ip);
+                break;
+
+            case OpcodeType::JumpBack:
+                run.ip = (cell != 0 ? partners[run.ip] : run.ip);
+                break;
+
+            case OpcodeType::IfZeroSkip:
+                if (!isValid(address))
+                {
+                    return run;
+                }
+
+                run.ip = (run.tape[address] == 0 ? partners[run.ip] : run.ip);
+                break;
+
+            case OpcodeType::NoOperation:
+            case OpcodeType::EndIf:
+                break;
+
+            default:
+                // Reads, and anything else the compile time runner does not understand, stop the run.
+                return run;
+            }
+        }
+
+        return run;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+Compiler::Compiler()
+{
+    setOptimizationLevel(DefaultOptimizationLevel);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::vector<instruction_t> Compiler::compile(std::string_view programtext) const
+{
+    auto instructions = parse(programtext);
+
+    // Passes run in the order they are declared. Optimizations that add and remove instructions come before jump
+    // linking, which needs the final position of every instruction, and so do the range checks for cells touched at an
+    // offset.
+    for (size_t i = 0; i < CompilerPassCount; ++i)
+    {
+        auto pass = static_cast<CompilerPass>(i);
+
+        if (pass == CompilerPass::LinkJumps)
+        {
+            checkOffsetRanges(instructions);
+        }
+
+        if (enabledPasses_[i] && (cellSize_ == 1 || !passNeedsByteCells(pass)))
+        {
+            runPass(pass, instructions);
+        }
+    }
+
+    // Insert end of program instruction.
+    instructions.push_back(instruction_t(OpcodeType::EndOfStream));
+
+    // Remove unused space from the list of instructions before returning.
+    instructions.shrink_to_fit();
+    return instructions;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::shared_ptr<const Program> Compiler::compileProgram(std::string_view programtext) const
+{
+    return std::make_shared<const Program>(compile(programtext), cellSize_, cellCount_);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::runPass(CompilerPass pass, std::vector<instruction_t>& instructions) const
+{
+    switch (pass)
+    {
+    case CompilerPass::MergeRuns:
+        mergeRuns(instructions);
+        break;
+
+    case CompilerPass::CancelRuns:
+        cancelRuns(instructions);
+        break;
+
+    case CompilerPass::DeadLoops:
+        removeDeadLoops(instructions);
+        break;
+
+    case CompilerPass::ClearLoops:
+        replaceClearLoops(instructions);
+        break;
+
+    case CompilerPass::MultiplyLoops:
+        replaceMultiplyLoops(instructions);
+        break;
+
+    case CompilerPass::ClosedFormLoops:
+        replaceClosedFormLoops(instructions);
+        break;
+
+    case CompilerPass::ScanLoops:
+        replaceScanLoops(instructions);
+        break;
+
+    case CompilerPass::IfLoops:
+        replaceIfLoops(instructions);
+        break;
+
+    case CompilerPass::OffsetAddressing:
+        // Offset addressing runs after the loop replacements because it needs the idiom instructions they create.
+        applyOffsetAddressing(instructions);
+        break;
+
+    case CompilerPass::ConstantPropagation:
+        propagateConstants(instructions);
+        break;
+
+    case CompilerPass::PartialEvaluation:
+        partiallyEvaluate(instructions);
+        break;
+
+    case CompilerPass::FoldConstantOutput:
+        foldConstantOutput(instructions);
+        break;
+
+    case CompilerPass::LinkJumps:
+        linkJumps(instructions);
+        break;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::setOptimizationLevel(int level)
+{
+    if (level < MinOptimizationLevel || level > MaxOptimizationLevel)
+    {
+        throw std::out_of_range("Optimization level must be between 0 and 3");
+    }
+
+    for (size_t i = 0; i < CompilerPassCount; ++i)
+    {
+        enabledPasses_[i] = (GPassTable[i].level <= level);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::string_view Compiler::passName(CompilerPass pass)
+{
+    return GPassTable[static_cast<size_t>(pass)].name;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::string_view Compiler::passDescription(CompilerPass pass)
+{
+    return GPassTable[static_cast<size_t>(pass)].description;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+int Compiler::passOptimizationLevel(CompilerPass pass)
+{
+    return GPassTable[static_cast<size_t>(pass)].level;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool Compiler::passNeedsByteCells(CompilerPass pass) noexcept
+{
+    switch (pass)
+    {
+    case CompilerPass::ClosedFormLoops:
+    case CompilerPass::ConstantPropagation:
+    case CompilerPass::PartialEvaluation:
+    case CompilerPass::FoldConstantOutput:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::setCellSize(size_t bytes)
+{
+    if (bytes != 1 && bytes != 2 && bytes != 4 && bytes != 8)
+    {
+        throw std::out_of_range("Cell size must be 1, 2, 4 or 8 bytes");
+    }
+
+    cellSize_ = bytes;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::setCellCount(size_t count)
+{
+    if (count == 0)
+    {
+        throw std::out_of_range("Cell count must be at least one");
+    }
+
+    cellCount_ = count;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::optional<CompilerPass> Compiler::findPass(std::string_view name)
+{
+    for (const auto& info : GPassTable)
+    {
+        if (name == info.name)
+        {
+            return info.pass;
+        }
+    }
+
+    return std::nullopt;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::vector<instruction_t> Compiler::parse(std::string_view programtext) const
+{
+    std::vector<instruction_t> instructions;
+    instructions.reserve(programtext.size() + 1);  // Over-reserve for speed, and release extra at the end of compile.
+
+    // Track jump targets to report when unbalanced jumps are encountered.
+    std::stack<size_t> jumps;
+
+    // Track source code position for error reporting.
+    size_t nextCharIndex = 0;
+    int lineNumber = 1;
+    int columnNumber = 0;
+
+    // Convert each legal character in the programtext to its compiled brainfreeze instruction form.    
+    for (auto c : programtext)
+    {
+        // Track source code position.
+        nextCharIndex++;
+        lineNumber = (c == '\n' ? lineNumber + 1 : lineNumber);
+        columnNumber = (c != '\n' ? columnNumber + 1 : 0);
+
+        // Skip characters that are not legal brainfreeze instructions.
+        if (!IsInstruction(c))
+        {
+            continue;
+        }
+
+        // Calculate the index that will be used for the next instruction written into the program.
+        auto nextIndex = instructions.size();
+
+        // Get the instruction form for this character.
+        auto instr = AsInstruction(c);
+
+        // Jump forwards need to have their position recorded so that unbalanced jumps can be detected when the
+        // matching backward jump is found.
+        if (instr.isA(OpcodeType::JumpForward))
+        {
+            // Record the jump forward position until the matching jumping backward instruction is located.
+            jumps.push(nextIndex);
+        }
+        else if (instr.isA(OpcodeType::JumpBack))
+        {
+            // Backward jump found. Pop the top jump marker off the stack which is the matching forwrad jump target.
+            // Throw an exception if there is not a matching forward [ jump.
+            if (jumps.empty())
+            {
+                throw CompileException(
+                    "Unbalanced jump, expected a [ before this ]",
+                    nextCharIndex - 1,
+                    lineNumber,
+                    columnNumber);
+            }
+
+            jumps.pop();
+        }
+
+        // Add this instruction to the program.
+        instructions.push_back(instr);
+    }
+
+    // Verify the jump stack is empty. If not, then there is an unmatched jump somewhere!
+    if (!jumps.empty())
+    {
+        throw CompileException(
+            "Unbalanced jump, expected a ] before program termination",
+            nextCharIndex - 1,
+            lineNumber,
+            columnNumber);
+    }
+
+    return instructions;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::mergeRuns(std::vector<instruction_t>& instructions) const
+{
+    // Is this instruction a repeat of the previous instruction? If it is a repeating instruction that supports merging
+    // (like increment/decrement) then merge it into the last instruction and increase the parameter count. Runs too
+    // long for one instruction's parameter continue in a new instruction.
+    size_t out = 0;
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        const auto& instr = instructions[i];
+
+        if (out > 0 &&
+            isMergable(instr) &&
+            instr.opcode() == instructions[out - 1].opcode() &&
+            std::numeric_limits<instruction_t::param_t>::max() - instructions[out - 1].param() >= instr.param())
+        {
+            instructions[out - 1].incrementParam(instr.param());
+        }
+        else
+        {
+            instructions[out++] = instr;
+        }
+    }
+
+    instructions.resize(out);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::cancelRuns(std::vector<instruction_t>& instructions) const
+{
+    // Sum each run of cell changes or pointer moves and emit the net change in its place. One byte cells wrap around at
+    // 256 so the net cell change is taken modulo 256, and emitted as whichever of an increment or decrement is
+    // smaller. Wider cells get the exact net change, split across instructions if it is too large for one.
+    std::vector<instruction_t> output;
+    output.reserve(instructions.size());
+
+    for (size_t i = 0; i < instructions.size();)
+    {
+        const auto& instr = instructions[i];
+
+        if (instr.isA(OpcodeType::MemInc) || instr.isA(OpcodeType::MemDec))
+        {
+            int net = 0;
+
+            for (; i < instructions.size() && instructions[i].offset() == instr.offset(); ++i)
+            {
+                if (instructions[i].isA(OpcodeType::MemInc))
+                {
+                    net += instructions[i].param();
+                }
+                else if (instructions[i].isA(OpcodeType::MemDec))
+                {
+                    net -= instructions[i].param();
+                }
+                else
+                {
+                    break;
+                }
+            }
+
+            if (cellSize_ == 1)
+            {
+                auto amount = static_cast<uint8_t>(net);
+                net = (amount < 128 ? amount : amount - 256);
+            }
+
+            while (net != 0)
+            {
+                auto amount = std::min(std::abs(net), (int)std::numeric_limits<instruction_t::param_t>::max());
+                output.push_back(instruction_t(
+                    net > 0 ? OpcodeType::MemInc : OpcodeType::MemDec,
+                    static_cast<instruction_t::param_t>(amount),
+                    instr.offset()));
+                net += (net > 0 ? -amount : amount);
+            }
+        }
+        else if (instr.isA(OpcodeType::PtrInc) || instr.isA(OpcodeType::PtrDec))
+        {
+            int net = 0;
+
+            for (; i < instructions.size(); ++i)
+            {
+                if (instructions[i].isA(OpcodeType::PtrInc))
+                {
+                    net += instructions[i].param();
+                }
+                else if (instructions[i].isA(OpcodeType::PtrDec))
+                {
+                    net -= instructions[i].param();
+                }
+                else
+                {
+                    break;
+                }
+            }
+
+            AppendPointerMove(output, net);
+        }
+        else
+        {
+            output.push_back(instr);
+            ++i;
+        }
+    }
+
+    instructions = std::move(output);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::removeDeadLoops(std::vector<instruction_t>& instructions) const
+{
+    // Every cell is zero when the program starts, and the current cell is zero whenever a loop exits. A loop that
+    // starts on a cell known to be zero skips straight past its body, so the whole loop is removed. Removing a loop
+    // changes nothing about the cells, which lets a run of loops like [..][..][..] be removed after the first.
+    bool areAllCellsZero = true;
+    bool isCellZero = true;
+    size_t out = 0;
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        const auto& instr = instructions[i];
+
+        switch (instr.opcode())
+        {
+        case OpcodeType::JumpForward:
+            if (isCellZero)
+            {
+                auto begin = instructions.cbegin();
+                i = static_cast<size_t>(FindJumpTarget(begin, instructions.cend(), begin + i) - begin);
+                continue;
+            }
+
+            // The loop body only runs when the current cell is not zero.
+            isCellZero = false;
+            areAllCellsZero = false;
+            break;
+
+        case OpcodeType::JumpBack:
+            isCellZero = true;
+            areAllCellsZero = false;
+            break;
+
+        case OpcodeType::PtrInc:
+        case OpcodeType::PtrDec:
+            isCellZero = areAllCellsZero;
+            break;
+
+        case OpcodeType::ScanRight:
+        case OpcodeType::ScanLeft:
+            isCellZero = true;
+            break;
+
+        case OpcodeType::SetZero:
+            isCellZero = (isCellZero || instr.offset() == 0);
+            break;
+
+        case OpcodeType::NoOperation:
+        case OpcodeType::Write:
+        case OpcodeType::PrintString:
+            break;
+
+        default:
+            // Anything else may change the cell it addresses.
+            isCellZero = (isCellZero && instr.offset() != 0);
+            areAllCellsZero = false;
+            break;
+        }
+
+        instructions[out++] = instr;
+    }
+
+    instructions.resize(out);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::replaceClearLoops(std::vector<instruction_t>& instructions) const
+{
+    // A clear loop is a loop whose body only adds or subtracts an odd amount from the current cell, such as [-] or
+    // [+]. An odd step always reaches zero regardless of the cell's starting value or width, so the loop can be
+    // replaced with an instruction that sets the cell to zero. If the loop is immediately followed by + or - then
+    // fold that in and set the cell to the final value.
+    auto isAdjust = [](const instruction_t& i) {
+        return i.isA(OpcodeType::MemInc) || i.isA(OpcodeType::MemDec);
+    };
+
+    size_t out = 0;
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        if (i + 2 < instructions.size() &&
+            instructions[i].isA(OpcodeType::JumpForward) &&
+            isAdjust(instructions[i + 1]) &&
+            instructions[i + 1].param() % 2 != 0 &&
+            instructions[i + 2].isA(OpcodeType::JumpBack))
+        {
+            i += 2;
+
+            if (i + 1 < instructions.size() && isAdjust(instructions[i + 1]))
+            {
+                i += 1;
+
+                auto value = instructions[i].param();
+                instructions[out++] = instruction_t(
+                    OpcodeType::SetValue,
+                    static_cast<instruction_t::param_t>(instructions[i].isA(OpcodeType::MemInc) ? value : -value));
+            }
+            else
+            {
+                instructions[out++] = instruction_t(OpcodeType::SetZero);
+            }
+        }
+        else
+        {
+            instructions[out++] = instructions[i];
+        }
+    }
+
+    instructions.resize(out);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::replaceMultiplyLoops(std::vector<instruction_t>& instructions) const
+{
+    // A multiply loop only moves the pointer and adjusts cells, returns the pointer to where it started and changes
+    // the loop cell by exactly one each iteration, such as [->+>+++<<]. The loop runs once per unit in the loop cell
+    // so each other cell it touches is increased by the loop cell's value times the amount added per iteration. The
+    // loop is replaced with a MulAdd for each of those cells followed by a SetZero for the loop cell.
+    size_t out = 0;
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        if (!instructions[i].isA(OpcodeType::JumpForward))
+        {
+            instructions[out++] = instructions[i];
+            continue;
+        }
+
+        // Sum the adjustments made to each cell relative to the loop cell. Only innermost loops containing nothing
+        // but pointer movement and cell adjustment are candidates.
+        std::map<int, int> deltas;
+        int position = 0;
+        size_t end = i + 1;
+
+        for (; end < instructions.size(); ++end)
+        {
+            const auto& instr = instructions[end];
+
+            if (instr.isA(OpcodeType::PtrInc))
+            {
+                position += instr.param();
+            }
+            else if (instr.isA(OpcodeType::PtrDec))
+            {
+                position -= instr.param();
+            }
+            else if (instr.isA(OpcodeType::MemInc))
+            {
+                deltas[position] += instr.param();
+            }
+            else if (instr.isA(OpcodeType::MemDec))
+            {
+                deltas[position] -= instr.param();
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        auto isMultiplyLoop = [&]() {
+            if (end == instructions.size() || !instructions[end].isA(OpcodeType::JumpBack) || position != 0)
+            {
+                return false;
+            }
+
+            if (deltas[0] != -1 && deltas[0] != 1)
+            {
+                return false;
+            }
+
+            // Every target cell must be addressable with an instruction offset, and every factor must fit in an
+            // instruction parameter.
+            for (const auto& [offset, delta] : deltas)
+            {
+                if (offset < std::numeric_limits<instruction_t::offset_t>::min() ||
+                    offset > std::numeric_limits<instruction_t::offset_t>::max() ||
+                    delta < std::numeric_limits<instruction_t::param_t>::min() ||
+                    delta > std::numeric_limits<instruction_t::param_t>::max())
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        };
+
+        if (!isMultiplyLoop())
+        {
+            instructions[out++] = instructions[i];
+            continue;
+        }
+
+        // A loop that counts the loop cell up instead of down runs (0 - value) times given wrap around arithmetic, so
+        // negate the factors to compensate.
+        const int sign = -deltas[0];
+
+        for (const auto& [offset, delta] : deltas)
+        {
+            if (offset != 0 && delta != 0)
+            {
+                instructions[out++] = instruction_t(
+                    OpcodeType::MulAdd,
+                    static_cast<instruction_t::param_t>(delta * sign),
+                    static_cast<instruction_t::offset_t>(offset));
+            }
+        }
+
+        instructions[out++] = instruction_t(OpcodeType::SetZero);
+        i = end;
+    }
+
+    instructions.resize(out);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::replaceClosedFormLoops(std::vector<instruction_t>& instructions) const
+{
+    // After multiply loops are replaced, the outer loop of a nest like a[-b[-t+u+b]u[-b+u]a] is straight line code
+    // that changes the loop cell by one each iteration. If each iteration leaves every other cell either unchanged,
+    // set to a constant, or increased by a sum of multiples of unchanged cells, then running the loop n times is the
+    // same as adding n times each increase. Those products are computed with ProductAdd and MulAdd instead.
+    //
+    // Cells that are set to a constant hold that constant from the second iteration onwards. When another cell uses
+    // one of them the first iteration is different from the rest, so it is run as is before the closed form.
+    std::vector<instruction_t> output;
+    output.reserve(instructions.size());
+
+    auto fitsOffset = [](int offset) {
+        return offset >= std::numeric_limits<instruction_t::offset_t>::min() &&
+            offset <= std::numeric_limits<instruction_t::offset_t>::max();
+    };
+
+    auto replaceLoop = [&](size_t start, size_t end) {
+        auto iteration = FollowIteration(instructions, start, end);
+
+        if (!iteration.has_value())
+        {
+            return false;
+        }
+
+        auto& cells = *iteration;
+        const auto counter = cells.find(0);
+
+        if (counter == cells.end() ||
+            counter->second.factors != std::map<int, uint8_t>{ { 0, 1 } } ||
+            (counter->second.constant != 1 && counter->second.constant != 255))
+        {
+            return false;
+        }
+
+        // A loop that counts up runs (0 - value) times given wrap around arithmetic, so negate each increase.
+        const int iterationSign = (counter->second.constant == 255 ? 1 : -1);
+        cells.erase(counter);
+
+        // Cells set to a constant, and the value of every other cell once those constants are in place.
+        std::map<int, uint8_t> constants;
+        bool needsFirstIteration = false;
+
+        for (const auto& [cell, value] : cells)
+        {
+            if (value.factors.count(0) != 0 || !fitsOffset(cell))
+            {
+                return false;
+            }
+
+            if (value.factors.empty())
+            {
+                constants[cell] = value.constant;
+            }
+        }
+
+        for (auto& [cell, value] : cells)
+        {
+            for (const auto& [constantCell, constant] : constants)
+            {
+                if (auto itr = value.factors.find(constantCell); itr != value.factors.end())
+                {
+                    value.constant = static_cast<uint8_t>(value.constant + itr->second * constant);
+                    value.factors.erase(itr);
+                    needsFirstIteration = true;
+                }
+            }
+        }
+
+        auto isUnchanged = [&](int cell) {
+            auto itr = cells.find(cell);
+            return itr == cells.end() ||
+                (itr->second.factors == std::map<int, uint8_t>{ { cell, 1 } } && itr->second.constant == 0);
+        };
+
+        for (const auto& [cell, value] : cells)
+        {
+            if (constants.count(cell) != 0)
+            {
+                continue;
+            }
+
+            auto self = value.factors.find(cell);
+
+            if (self == value.factors.end() || self->second != 1)
+            {
+                return false;
+            }
+
+            for (const auto& [source, factor] : value.factors)
+            {
+                if (source != cell && (!isUnchanged(source) || !fitsOffset(source)))
+                {
+                    return false;
+                }
+            }
+        }
+
+        // The loop is only kept to guard against running the body, or setting the constant cells, when the loop
+        // cell starts at zero. ProductAdd and MulAdd do nothing in that case by themselves.
+        const bool needsGuard = needsFirstIteration || !constants.empty();
+
+        if (needsGuard)
+        {
+            output.push_back(instruction_t(OpcodeType::JumpForward));
+        }
+
+        if (needsFirstIteration)
+        {
+            output.insert(output.end(), instructions.begin() + start + 1, instructions.begin() + end);
+        }
+
+        for (const auto& [cell, value] : cells)
+        {
+            const auto offset = static_cast<instruction_t::offset_t>(cell);
+
+            for (const auto& [source, factor] : value.factors)
+            {
+                if (source != cell)
+                {
+                    output.push_back(instruction_t(
+                        OpcodeType::ProductAdd,
+                        static_cast<int8_t>(factor * iterationSign),
+                        offset));
+                    output.push_back(instruction_t(
+                        OpcodeType::NoOperation,
+                        0,
+                        static_cast<instruction_t::offset_t>(source)));
+                }
+            }
+
+            if (value.constant != 0 && constants.count(cell) == 0)
+            {
+                output.push_back(instruction_t(
+                    OpcodeType::MulAdd,
+                    static_cast<int8_t>(value.constant * iterationSign),
+                    offset));
+            }
+        }
+
+        if (!needsFirstIteration)
+        {
+            for (const auto& [cell, constant] : constants)
+            {
+                output.push_back(instruction_t(
+                    constant == 0 ? OpcodeType::SetZero : OpcodeType::SetValue,
+                    static_cast<int8_t>(constant),
+                    static_cast<instruction_t::offset_t>(cell)));
+            }
+        }
+
+        output.push_back(instruction_t(OpcodeType::SetZero));
+
+        if (needsGuard)
+        {
+            output.push_back(instruction_t(OpcodeType::JumpBack));
+        }
+
+        return true;
+    };
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        if (!instructions[i].isA(OpcodeType::JumpForward))
+        {
+            output.push_back(instructions[i]);
+            continue;
+        }
+
+        // Only loops without nested loops are candidates, since multiply loops inside them have been replaced.
+        size_t end = i + 1;
+
+        while (!IsJumpStart(instructions[end]) && !IsJumpEnd(instructions[end]))
+        {
+            ++end;
+        }
+
+        if (instructions[end].isA(OpcodeType::JumpBack) && replaceLoop(i, end))
+        {
+            i = end;
+        }
+        else
+        {
+            output.push_back(instructions[i]);
+        }
+    }
+
+    instructions = std::move(output);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::replaceScanLoops(std::vector<instruction_t>& instructions) const
+{
+    // A scan loop only moves the pointer, such as [>] or [<<<], so it stops at the first zero cell found by stepping
+    // through memory with the loop's stride. Replace it with a single instruction that can search for that cell.
+    size_t out = 0;
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        if (i + 2 < instructions.size() &&
+            instructions[i].isA(OpcodeType::JumpForward) &&
+            (instructions[i + 1].isA(OpcodeType::PtrInc) || instructions[i + 1].isA(OpcodeType::PtrDec)) &&
+            instructions[i + 2].isA(OpcodeType::JumpBack))
+        {
+            const auto& move = instructions[i + 1];
+            instructions[out++] = instruction_t(
+                move.isA(OpcodeType::PtrInc) ? OpcodeType::ScanRight : OpcodeType::ScanLeft,
+                move.param());
+            i += 2;
+        }
+        else
+        {
+            instructions[out++] = instructions[i];
+        }
+    }
+
+    instructions.resize(out);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::replaceIfLoops(std::vector<instruction_t>& instructions) const
+{
+    // A loop whose body always returns the pointer to the loop cell and leaves that cell zero, such as [>+<[-]] or
+    // [->>[-]<<[-]], can only run its body once. It becomes an IfZeroSkip that skips the body when the cell is zero
+    // and an EndIf that falls through, removing the test and branch back at the end of the body.
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        if (!instructions[i].isA(OpcodeType::JumpForward))
+        {
+            continue;
+        }
+
+        if (auto shape = AnalyzeLoop(instructions, i); shape.clearsLoopCell)
+        {
+            instructions[i] = instruction_t(OpcodeType::IfZeroSkip);
+            instructions[shape.end] = instruction_t(OpcodeType::EndIf);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::applyOffsetAddressing(std::vector<instruction_t>& instructions) const
+{
+    // Rather than moving the memory pointer back and forth within a basic block, track where the pointer would be
+    // and address cells with an offset relative to it. The net movement is applied once when the real memory pointer
+    // is needed, which is at the end of the block (before jumps), before instructions that do not take an offset and
+    // when the next offset is too large to encode. The body of an IfZeroSkip always returns the pointer to where it
+    // started, so the block carries on into it and the position is restored at its EndIf.
+    std::vector<instruction_t> output;
+    output.reserve(instructions.size());
+
+    int position = 0;
+    std::stack<int> ifPositions;
+
+    auto flush = [&]() {
+        AppendPointerMove(output, position);
+        position = 0;
+    };
+
+    // Instructions created by earlier passes can already have an offset, which the position is added to.
+    auto fitsOffset = [](int offset) {
+        return offset >= std::numeric_limits<instruction_t::offset_t>::min() &&
+            offset <= std::numeric_limits<instruction_t::offset_t>::max();
+    };
+
+    for (const auto& instr : instructions)
+    {
+        switch (instr.opcode())
+        {
+        case OpcodeType::PtrInc:
+            position += instr.param();
+            break;
+
+        case OpcodeType::PtrDec:
+            position -= instr.param();
+            break;
+
+        case OpcodeType::MemInc:
+        case OpcodeType::MemDec:
+        case OpcodeType::Read:
+        case OpcodeType::Write:
+        case OpcodeType::SetZero:
+        case OpcodeType::SetValue:
+            if (!fitsOffset(position + instr.offset()))
+            {
+                flush();
+            }
+
+            output.push_back(instr);
+            output.back().setOffset(static_cast<instruction_t::offset_t>(position + instr.offset()));
+            break;
+
+        case OpcodeType::IfZeroSkip:
+            if (!fitsOffset(position + instr.offset()))
+            {
+                flush();
+            }
+
+            ifPositions.push(position);
+            output.push_back(instr);
+            output.back().setOffset(static_cast<instruction_t::offset_t>(position + instr.offset()));
+            break;
+
+        case OpcodeType::EndIf:
+            // The body may have moved the real memory pointer. Move it back so that it is the same whether or not
+            // the body ran.
+            AppendPointerMove(output, position - ifPositions.top());
+            position = ifPositions.top();
+            ifPositions.pop();
+            output.push_back(instr);
+            break;
+
+        default:
+            // Jumps, scans and MulAdd operate on the cell at the real memory pointer.
+            flush();
+            output.push_back(instr);
+            break;
+        }
+    }
+
+    flush();
+    instructions = std::move(output);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::propagateConstants(std::vector<instruction_t>& instructions) const
+{
+    // Every cell starts as zero, and straight line code changes cells in ways that can be followed at compile time.
+    // Knowledge flows into a loop's body and out of the loop for every cell the loop never changes, and the loop cell
+    // is zero after it exits. Both paths around an IfZeroSkip are followed and joined again at its EndIf. Loops and
+    // skips that start on a cell known to be zero are removed, and skips on a cell known to be non-zero always run.
+    std::vector<instruction_t> output;
+    output.reserve(instructions.size());
+
+    known_cells_t known;
+    int position = 0;
+
+    // What was known at the start of each loop being followed, which holds at the start of every iteration and when
+    // the loop exits.
+    std::stack<known_cells_t> loopEntries;
+
+    // For each IfZeroSkip being followed, if it is kept because the body may be skipped and what was known if it was.
+    struct if_block_t
+    {
+        bool mayBeSkipped = false;
+        known_cells_t skipped;
+    };
+
+    std::stack<if_block_t> ifBlocks;
+
+    auto appendStore = [&](int8_t value, instruction_t::offset_t offset) {
+        output.push_back(instruction_t(value == 0 ? OpcodeType::SetZero : OpcodeType::SetValue, value, offset));
+    };
+
+    auto appendAdd = [&](uint8_t amount, instruction_t::offset_t offset) {
+        output.push_back(amount < 128 ?
+            instruction_t(OpcodeType::MemInc, amount, offset) :
+            instruction_t(OpcodeType::MemDec, static_cast<instruction_t::param_t>(256 - amount), offset));
+    };
+
+    // Add a multiple of a known factor to a cell, which is how MulAdd and ProductAdd look once their factors are known.
+    auto addKnownAmount = [&](uint8_t amount, int address, instruction_t::offset_t offset) {
+        if (amount == 0)
+        {
+            return;
+        }
+
+        if (auto value = known.at(address); value.has_value())
+        {
+            known.cells[address] = static_cast<int8_t>(*value + amount);
+            appendStore(*known.cells[address], offset);
+        }
+        else
+        {
+            appendAdd(amount, offset);
+        }
+    };
+
+    auto skipBlock = [&](size_t i) {
+        auto target = FindJumpTarget(instructions.cbegin(), instructions.cend(), instructions.cbegin() + i);
+        return static_cast<size_t>(target - instructions.cbegin());
+    };
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        const auto& instr = instructions[i];
+        const int address = position + instr.offset();
+
+        switch (instr.opcode())
+        {
+        case OpcodeType::PtrInc:
+        case OpcodeType::PtrDec:
+            position += (instr.isA(OpcodeType::PtrInc) ? instr.param() : -instr.param());
+            output.push_back(instr);
+            break;
+
+        case OpcodeType::MemInc:
+        case OpcodeType::MemDec:
+            if (auto value = known.at(address); value.has_value())
+            {
+                auto delta = instr.isA(OpcodeType::MemInc) ? instr.param() : -instr.param();
+                known.cells[address] = static_cast<int8_t>(*value + delta);
+                appendStore(*known.cells[address], instr.offset());
+            }
+            else
+            {
+                output.push_back(instr);
+            }
+            break;
+
+        case OpcodeType::SetZero:
+        case OpcodeType::SetValue:
+            if (known.at(address) != std::optional<int8_t>(static_cast<int8_t>(instr.param())))
+            {
+                known.cells[address] = static_cast<int8_t>(instr.param());
+                output.push_back(instr);
+            }
+            break;
+
+        case OpcodeType::MulAdd:
+            if (auto factor = known.at(position); factor.has_value())
+            {
+                addKnownAmount(static_cast<uint8_t>(*factor * instr.param()), address, instr.offset());
+            }
+            else
+            {
+                known.cells[address] = std::nullopt;
+                output.push_back(instr);
+            }
+            break;
+
+        case OpcodeType::ProductAdd:
+        {
+            // The source's offset is in the no-op word that follows, which is kept or removed along with it.
+            const auto& operand = instructions[++i];
+            auto factor = known.at(position);
+            auto source = known.at(position + operand.offset());
+
+            if (factor.has_value() && source.has_value())
+            {
+                addKnownAmount(static_cast<uint8_t>(*factor * *source * instr.param()), address, instr.offset());
+            }
+            else if (source == std::optional<int8_t>(0) || factor == std::optional<int8_t>(0))
+            {
+                // Nothing is added when either factor is zero.
+            }
+            else if (source.has_value())
+            {
+                known.cells[address] = std::nullopt;
+                output.push_back(instruction_t(
+                    OpcodeType::MulAdd,
+                    static_cast<int8_t>(*source * instr.param()),
+                    instr.offset()));
+            }
+            else
+            {
+                known.cells[address] = std::nullopt;
+                output.push_back(instr);
+                output.push_back(operand);
+            }
+            break;
+        }
+
+        case OpcodeType::Read:
+            known.cells[address] = std::nullopt;
+            output.push_back(instr);
+            break;
+
+        case OpcodeType::PrintString:
+        {
+            auto words = instruction_t::stringDataWordCount(static_cast<size_t>(instr.param()));
+            output.insert(output.end(), instructions.begin() + i, instructions.begin() + i + 1 + words);
+            i += words;
+            break;
+        }
+
+        case OpcodeType::ScanRight:
+        case OpcodeType::ScanLeft:
+            known.forget();
+            known.cells[position] = 0;
+            output.push_back(instr);
+            break;
+
+        case OpcodeType::JumpForward:
+            if (known.at(position) == std::optional<int8_t>(0))
+            {
+                i = skipBlock(i);
+                break;
+            }
+
+            if (auto writes = FindLoopWrites(instructions, i); writes.has_value())
+            {
+                for (auto cell : *writes)
+                {
+                    known.cells[position + cell] = std::nullopt;
+                }
+            }
+            else
+            {
+                known.forget();
+            }
+
+            loopEntries.push(known);
+            output.push_back(instr);
+            break;
+
+        case OpcodeType::JumpBack:
+            // A loop that moves the pointer forgot every cell when it started, so the position it ends at does not
+            // matter.
+            known = std::move(loopEntries.top());
+            loopEntries.pop();
+            known.cells[position] = 0;
+            output.push_back(instr);
+            break;
+
+        case OpcodeType::IfZeroSkip:
+            if (auto value = known.at(address); value == std::optional<int8_t>(0))
+            {
+                i = skipBlock(i);
+            }
+            else if (value.has_value())
+            {
+                ifBlocks.push({ false, {} });
+            }
+            else
+            {
+                ifBlocks.push({ true, known });
+                ifBlocks.top().skipped.cells[address] = 0;
+                output.push_back(instr);
+            }
+            break;
+
+        case OpcodeType::EndIf:
+            if (ifBlocks.top().mayBeSkipped)
+            {
+                known.meet(ifBlocks.top().skipped);
+                output.push_back(instr);
+            }
+
+            ifBlocks.pop();
+            break;
+
+        default:
+            output.push_back(instr);
+            break;
+        }
+    }
+
+    instructions = std::move(output);
+}
+
 //---------------------------------------------------------------------------------------------------------------------
-std::vector<instruction_t> Compiler::compile(std::string_view programtext) const
+void Compiler::partiallyEvaluate(std::vector<instruction_t>& instructions) const
 {
-    std::vector<instruction_t> instructions;
-    instructions.reserve(programtext.size());      // Over-reserve for speed, and release extra at the end of compile.
+    // The program can only be cut where the rest of it still makes sense on its own, which is outside of every loop.
+    // A ] or EndIf is not a resumable point because it belongs to a block that would be cut in half.
+    constexpr size_t NotAJump = (size_t)-1;
 
-    // Track jump targets for optimization (And also report when unbalanced jumps are encountered).
+    std::vector<size_t> partners(instructions.size(), NotAJump);
+    std::vector<bool> resumable(instructions.size(), false);
     std::stack<size_t> jumps;
 
-    // Track source code position for error reporting.
-    size_t nextCharIndex = 0;
-    int lineNumber = 1;
-    int columnNumber = 0;
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        resumable[i] = jumps.empty() && !IsJumpEnd(instructions[i]);
 
-    // Convert each legal character in the programtext to its compiled brainfreeze instruction form.    
-    for (auto c : programtext)
+        if (IsJumpStart(instructions[i]))
+        {
+            jumps.push(i);
+        }
+        else if (IsJumpEnd(instructions[i]))
+        {
+            assert(!jumps.empty());
+
+            partners[i] = jumps.top();
+            partners[jumps.top()] = i;
+            jumps.pop();
+        }
+    }
+
+    // Run the program, and if it stopped inside a loop run it again up to the last point it could be cut.
+    size_t lastResumableStep = 0;
+    auto run = RunPrefix(instructions, partners, resumable, cellCount_, partialEvaluationBudget_, lastResumableStep);
+
+    if (run.ip < instructions.size() && !resumable[run.ip])
     {
-        // Track source code position.
-        nextCharIndex++;
-        lineNumber = (c == '\n' ? lineNumber + 1 : lineNumber);
-        columnNumber = (c != '\n' ? columnNumber + 1 : 0);
+        size_t unused = 0;
+        run = RunPrefix(instructions, partners, resumable, cellCount_, lastResumableStep, unused);
+    }
 
-        // Skip characters that are not legal brainfreeze instructions.
-        if (!IsInstruction(c))
+    if (run.steps == 0)
+    {
+        return;
+    }
+
+    // Recreate the memory with SetValue instructions, leave the pointer where the program had moved it and print
+    // everything the program wrote. Then continue with the instructions that did not run.
+    std::vector<instruction_t> output;
+    int position = 0;
+
+    for (size_t address = 0; address < run.tape.size(); ++address)
+    {
+        if (run.tape[address] == 0)
         {
             continue;
         }
 
-        // Calculate the index that will be used for the next instruction written into the program.
-        auto nextIndex = instructions.size();
+        if ((int)address - position > std::numeric_limits<instruction_t::offset_t>::max())
+        {
+            AppendPointerMove(output, (int)address - position);
+            position = (int)address;
+        }
 
-        // Get the instruction form for this character.
-        auto instr = AsInstruction(c);
+        output.push_back(instruction_t(
+            OpcodeType::SetValue,
+            run.tape[address],
+            static_cast<instruction_t::offset_t>((int)address - position)));
+    }
 
-        // Handle jump instructions specially. Jump forwards need to have their position recorded so that when the
-        // matching backward jump is found both jumps can have their offset written into them for optimization.
-        if (instr.isA(OpcodeType::JumpForward))
+    AppendPointerMove(output, (int)run.pointer - position);
+    AppendPrintString(output, run.output);
+
+    output.insert(output.end(), instructions.begin() + run.ip, instructions.end());
+    instructions = std::move(output);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::foldConstantOutput(std::vector<instruction_t>& instructions) const
+{
+    // Every cell starts as zero, and straight line code only changes cells in ways that can be followed at compile
+    // time. Loops, reads and scans make cells unknown except for the few that must be zero afterwards (a loop or scan
+    // always stops on a zero cell). Writes of known cells are grouped until the next instruction that does I/O or
+    // changes control flow, and each group of two or more is printed by one PrintString placed at its first write.
+    // Cells are keyed by their position relative to where the memory pointer was when tracking started.
+    //
+    // A PrintString prints its whole group before anything after the first write runs, so nothing in a group may be
+    // able to fail part way through. The cells between those the program has already moved to or touched are known to
+    // be in memory, and a write of a cell outside of them, or a move or touch outside of them inside a group, ends the
+    // group before it. Such a write is left to check its own cell.
+    constexpr size_t MaxStringLength = (size_t)std::numeric_limits<instruction_t::param_t>::max();
+    constexpr size_t NotFolded = (size_t)-1;
+    constexpr size_t Dropped = (size_t)-2;
+
+    std::map<int, std::optional<int8_t>> cells;
+    bool areOtherCellsZero = true;
+    int position = 0;
+    std::pair<int, int> inMemory(0, 0);
+
+    // For each IfZeroSkip being followed, the cell it tests and whether its body is known to run, which makes the
+    // body straight line code, and the cells known to be in memory before the body.
+    std::stack<std::pair<int, bool>> ifBodies;
+    std::stack<std::pair<int, int>> ifInMemory;
+
+    auto cellAt = [&](int address) -> std::optional<int8_t> {
+        auto itr = cells.find(address);
+        return itr != cells.end() ? itr->second : (areOtherCellsZero ? std::optional<int8_t>(0) : std::nullopt);
+    };
+
+    // Only the cell the pointer stopped on is known after a loop or scan.
+    auto forgetAllButZeroAtPointer = [&]() {
+        cells.clear();
+        cells[position] = 0;
+        areOtherCellsZero = false;
+        inMemory = { position, position };
+    };
+
+    auto isInMemory = [&](int address) {
+        return address >= inMemory.first && address <= inMemory.second;
+    };
+
+    // Each write is either not folded, dropped because an earlier write prints it, or the first write of a group in
+    // which case it holds the index of the group's text.
+    std::vector<size_t> folds(instructions.size(), NotFolded);
+    std::vector<std::string> texts;
+    size_t groupStart = NotFolded;
+
+    auto endGroup = [&]() {
+        if (groupStart != NotFolded && texts.back().size() < 2)
         {
-            // If jump optimization is enabled upgrade this instruction to a fast jump forward.
-            if (isPrecalculateJumpOffsetsEnabled())
-            {
-                instr.setOpcode(OpcodeType::FastJumpForward);
-            }
+            folds[groupStart] = NotFolded;
+            texts.pop_back();
+        }
 
-            // Record the jump forward position until the matching jumping backward instruction is located.
-            jumps.push(nextIndex);
+        groupStart = NotFolded;
+    };
+
+    // Note a cell the program moves to or touches unconditionally, which is in memory after that, and end the group
+    // if it might not have been before.
+    auto reach = [&](int address) {
+        if (!isInMemory(address))
+        {
+            endGroup();
+            inMemory = { std::min(inMemory.first, address), std::max(inMemory.second, address) };
         }
-        else if (instr.isA(OpcodeType::JumpBack))
+    };
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        const auto& instr = instructions[i];
+        const int address = position + instr.offset();
+
+        switch (instr.opcode())
         {
-            // Backward jump found. Pop the top jump marker off the stack which is the matching forwrad jump target.
-            // Write the offset of the jump into both the forward and backward jump instructions.
+        case OpcodeType::PtrInc:
+            position += instr.param();
+            reach(position);
+            break;
 
-            // Throw an exception if there is not a matching forward [ jump.
-            if (jumps.empty())
+        case OpcodeType::PtrDec:
+            position -= instr.param();
+            reach(position);
+            break;
+
+        case OpcodeType::MemInc:
+        case OpcodeType::MemDec:
+            reach(address);
+
+            if (auto value = cellAt(address); value.has_value())
             {
-                throw CompileException(
-                    "Unbalanced jump, expected a [ before this ]",
-                    nextCharIndex - 1,
-                    lineNumber,
-                    columnNumber);
+                auto delta = instr.isA(OpcodeType::MemInc) ? instr.param() : -instr.param();
+                cells[address] = static_cast<int8_t>(*value + delta);
+            }
+            break;
+
+        case OpcodeType::SetZero:
+        case OpcodeType::SetValue:
+            reach(address);
+            cells[address] = static_cast<int8_t>(instr.param());
+            break;
+
+        case OpcodeType::MulAdd:
+            // Multiplies only touch their cells when the current cell is non-zero.
+            if (!isInMemory(address))
+            {
+                endGroup();
             }
 
-            // If the jump optimization is enabled upgrade this instruction to a fast jump backward. Search for the
-            // corresponding forward jump instruction and write the offset into both. If the optimization is disabled
-            // then leave the jump instruction alone.
-            if (isPrecalculateJumpOffsetsEnabled())
+            if (auto factor = cellAt(position); !factor.has_value())
+            {
+                cells[address] = std::nullopt;
+            }
+            else if (auto value = cellAt(address); value.has_value())
             {
-                // Upgrade to fast jump.
-                instr.setOpcode(OpcodeType::FastJumpBack);
+                cells[address] = static_cast<int8_t>(*value + *factor * instr.param());
+            }
+            break;
 
-                // Get the offset of the matching forward [ jump.
-                auto forwardJumpOffset = jumps.top();
-                jumps.pop();
+        case OpcodeType::ProductAdd:
+        {
+            auto factor = cellAt(position);
+            auto source = cellAt(position + instructions[i + 1].offset());
+
+            if (!isInMemory(address) || !isInMemory(position + instructions[i + 1].offset()))
+            {
+                endGroup();
+            }
 
-                auto distance = nextIndex - forwardJumpOffset;
-                assert(distance > 0);
+            if (!factor.has_value() || !source.has_value())
+            {
+                cells[address] = std::nullopt;
+            }
+            else if (auto value = cellAt(address); value.has_value())
+            {
+                cells[address] = static_cast<int8_t>(*value + *factor * *source * instr.param());
+            }
+            break;
+        }
 
-                // Verify the jump distance is small enough to fit in the instruction parameter.
-                // TODO: This should be supported on the off-chance it is encountered in the real world.
-                if (distance > (size_t)std::numeric_limits<instruction_t::param_t>::max())
+        case OpcodeType::Write:
+            if (auto value = cellAt(address); value.has_value() && isInMemory(address))
+            {
+                if (groupStart == NotFolded || texts.back().size() == MaxStringLength)
+                {
+                    endGroup();
+                    groupStart = i;
+                    folds[i] = texts.size();
+                    texts.emplace_back();
+                }
+                else
                 {
-                    throw CompileException(
-                        "Jump target to large to fit in instruction",
-                        nextCharIndex - 1,
-                        lineNumber,
-                        columnNumber);
+                    folds[i] = Dropped;
                 }
 
-                // Store the offset in the [ instruction.
-                instructions[forwardJumpOffset].setParam(static_cast<instruction_t::param_t>(distance));
+                texts.back().push_back(static_cast<char>(*value));
+            }
+            else
+            {
+                endGroup();
+                reach(address);
+            }
+            break;
+
+        case OpcodeType::Read:
+            endGroup();
+            reach(address);
+            cells[address] = std::nullopt;
+            break;
+
+        case OpcodeType::ScanRight:
+        case OpcodeType::ScanLeft:
+            endGroup();
+            forgetAllButZeroAtPointer();
+            break;
+
+        case OpcodeType::JumpForward:
+            endGroup();
+
+            if (cellAt(position) == std::optional<int8_t>(0))
+            {
+                // The loop is never entered so nothing changes. Skip to its ] and carry on from there.
+                i = FindJumpTarget(instructions.begin(), instructions.end(), instructions.begin() + i) -
+                    instructions.begin();
+            }
+            else
+            {
+                // The loop body can be reached again from its ], so nothing about the cells is known inside it.
+                cells.clear();
+                areOtherCellsZero = false;
+                inMemory = { position, position };
+            }
+            break;
+
+        case OpcodeType::JumpBack:
+            endGroup();
+            forgetAllButZeroAtPointer();
+            break;
 
-                // Store the offset in the current ] instruction.
-                instr.setParam(static_cast<instruction_t::param_t>(distance));
+        case OpcodeType::IfZeroSkip:
+            endGroup();
+            reach(address);
+
+            if (auto value = cellAt(address); value == std::optional<int8_t>(0))
+            {
+                i = FindJumpTarget(instructions.begin(), instructions.end(), instructions.begin() + i) -
+                    instructions.begin();
             }
             else
             {
-                // Make sure the corresponding forward jump offset is removed from the stack even if the optimiation
-                // isn't being used. (The stack is still tracking if there are unbalanced jumps).
-                jumps.pop();
+                // The body runs exactly once when the cell is known to be non-zero, so keep following the cells.
+                ifBodies.push({ address, value.has_value() });
+                ifInMemory.push(inMemory);
+
+                if (!value.has_value())
+                {
+                    cells.clear();
+                    areOtherCellsZero = false;
+                }
+            }
+            break;
+
+        case OpcodeType::EndIf:
+            endGroup();
+
+            // Otherwise the body may or may not have run, and either way only the tested cell is known to be zero.
+            if (auto [tested, didRun] = ifBodies.top(); !didRun)
+            {
+                cells.clear();
+                cells[tested] = 0;
+                areOtherCellsZero = false;
+                inMemory = ifInMemory.top();
+            }
+
+            ifBodies.pop();
+            ifInMemory.pop();
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    endGroup();
+
+    if (texts.empty())
+    {
+        return;
+    }
+
+    // Replace the first write of each group with a PrintString and its data words, and remove the other writes.
+    std::vector<instruction_t> output;
+    output.reserve(instructions.size());
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        if (folds[i] == NotFolded)
+        {
+            output.push_back(instructions[i]);
+        }
+        else if (folds[i] != Dropped)
+        {
+            AppendPrintString(output, texts[folds[i]]);
+        }
+    }
+
+    instructions = std::move(output);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::checkOffsetRanges(std::vector<instruction_t>& instructions) const
+{
+    // Pointer moves are checked when they run, so the cell at the memory pointer is always in memory but a cell at an
+    // offset from it might not be. Each block of straight line code starts with a CheckRange covering the cells it
+    // touches at an offset, measured from the pointer at the start of the block. Blocks end at control flow and after
+    // console I/O, so a block that would touch a cell outside of memory stops after the output before it like the
+    // program would without offsets. Console I/O checks its own cell. MulAdd and ProductAdd only touch their cells
+    // when the current cell is non-zero, so a run of them reaching outside of the block's range gets its own
+    // CheckRangeIfNonZero. Memory is one contiguous range, so the cells between any two checked cells or cells the
+    // pointer has moved to are in memory too. What is known to be in memory carries over into the next block until a
+    // loop or scan moves the pointer by an unknown amount, and a check is left out when it would not add to that.
+    using cell_range_t = std::pair<long long, long long>;
+
+    constexpr long long MinLow = std::numeric_limits<instruction_t::offset_t>::min();
+    constexpr long long MaxLow = std::numeric_limits<instruction_t::offset_t>::max();
+    constexpr long long MaxHigh = std::numeric_limits<instruction_t::param_t>::max();
+    constexpr size_t NoRun = (size_t)-1;
+
+    /** A run of MulAdd and ProductAdd instructions in the current block. */
+    struct multiply_run_t
+    {
+        size_t start;               ///< Index in the block of the first instruction of the run.
+        size_t end;                 ///< Index in the block after the run, or NoRun once the run cannot be extended.
+        long long position;         ///< Position of the memory pointer in the block.
+        cell_range_t reached;       ///< Positions the memory pointer moved to in the block before the run.
+        std::optional<cell_range_t> range;
+    };
+
+    std::vector<instruction_t> output;
+    output.reserve(instructions.size());
+
+    std::vector<instruction_t> block;
+    std::vector<multiply_run_t> runs;
+    long long position = 0;
+    cell_range_t reached(0, 0);
+    std::optional<cell_range_t> range;
+    cell_range_t checked(0, 0);
+    std::stack<cell_range_t> ifChecked;
+
+    // Widen a range to take in cells at offsets from a position. The cell at the memory pointer, both where the range
+    // is measured from and at the position, is always in memory.
+    auto widen = [](std::optional<cell_range_t> range, long long position, std::initializer_list<int> offsets) {
+        for (auto offset : offsets)
+        {
+            const auto cell = position + offset;
+
+            if (offset != 0 && cell != 0)
+            {
+                range = cell_range_t(
+                    range ? std::min(range->first, cell) : cell,
+                    range ? std::max(range->second, cell) : cell);
+            }
+        }
+
+        return range;
+    };
+
+    auto fits = [&](const std::optional<cell_range_t>& range) {
+        return !range || (range->first >= MinLow && range->first <= MaxLow && range->second <= MaxHigh);
+    };
+
+    auto makeCheck = [](OpcodeType op, const cell_range_t& range) {
+        return instruction_t(
+            op,
+            static_cast<instruction_t::param_t>(range.second),
+            static_cast<instruction_t::offset_t>(range.first));
+    };
+
+    auto covers = [](const cell_range_t& outer, long long position, const cell_range_t& inner) {
+        return position + inner.first >= outer.first && position + inner.second <= outer.second;
+    };
+
+    auto join = [](const cell_range_t& range, long long first, long long second) {
+        return cell_range_t(std::min(range.first, first), std::max(range.second, second));
+    };
+
+    auto flush = [&]() {
+        if (range && !covers(checked, 0, *range))
+        {
+            output.push_back(makeCheck(OpcodeType::CheckRange, *range));
+            checked = join(checked, range->first, range->second);
+        }
+
+        auto run = runs.begin();
+
+        for (size_t i = 0; i < block.size(); ++i)
+        {
+            if (run != runs.end() && run->start == i)
+            {
+                const bool isCovered = !run->range ||
+                    covers(join(checked, run->reached.first, run->reached.second), run->position, *run->range);
+
+                if (!isCovered)
+                {
+                    output.push_back(makeCheck(OpcodeType::CheckRangeIfNonZero, *run->range));
+                }
+
+                ++run;
             }
+
+            output.push_back(block[i]);
         }
 
-        // Is this instruction a repeat of the previous instruction? If it is a repeating instruction that supports
-        // merging (like increment/decrement) then merge it into the last instruction and increase the parameter
-        // count.
-        if (mergeInstructions_ &&                                   // is the merge instruction optimization enabled?
-            isMergable(instr) &&                                    // is this instruction mergable?
-            instructions.size() > 0 &&                              // are there any instructions already stored?
-            instr.opcode() == instructions[nextIndex - 1].opcode()) // does this match previous instruction?
+        checked = join(checked, reached.first, reached.second);
+        checked = cell_range_t(checked.first - position, checked.second - position);
+
+        block.clear();
+        runs.clear();
+        position = 0;
+        reached = cell_range_t(0, 0);
+        range.reset();
+    };
+
+    // Start a new block at an instruction whose cells would make the range too wide to encode. Offsets always fit on
+    // their own.
+    auto touch = [&](std::initializer_list<int> offsets) {
+        if (auto widened = widen(range, position, offsets); fits(widened))
         {
-            // Increment the last instruction's parameter. Do not insert this instruction.
-            instructions[nextIndex - 1].incrementParam(1);
+            range = widened;
         }
         else
         {
-            // Add this instruction to the program.
-            instructions.push_back(instr);
+            flush();
+            range = widen(range, position, offsets);
+        }
+    };
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        const auto& instr = instructions[i];
+
+        switch (instr.opcode())
+        {
+        case OpcodeType::PtrInc:
+        case OpcodeType::PtrDec:
+            position += (instr.isA(OpcodeType::PtrInc) ? instr.param() : -instr.param());
+            reached = join(reached, position, position);
+            block.push_back(instr);
+            break;
+
+        case OpcodeType::MemInc:
+        case OpcodeType::MemDec:
+        case OpcodeType::SetZero:
+        case OpcodeType::SetValue:
+            touch({ instr.offset() });
+            block.push_back(instr);
+            break;
+
+        case OpcodeType::NoOperation:
+            block.push_back(instr);
+            break;
+
+        case OpcodeType::MulAdd:
+        case OpcodeType::ProductAdd:
+        {
+            // The no-op word after a ProductAdd holds the offset of its second factor. A run ends at an instruction
+            // that changes the current cell, since later ones test the new value.
+            const int source = (instr.isA(OpcodeType::ProductAdd) ? instructions[i + 1].offset() : 0);
+
+            if (runs.empty() || runs.back().end != block.size())
+            {
+                runs.push_back({ block.size(), NoRun, position, reached, std::nullopt });
+            }
+
+            auto& run = runs.back();
+            run.range = widen(run.range, 0, { instr.offset(), source });
+            block.push_back(instr);
+
+            if (instr.isA(OpcodeType::ProductAdd))
+            {
+                block.push_back(instructions[++i]);
+            }
+
+            run.end = (instr.offset() != 0 ? block.size() : NoRun);
+            break;
+        }
+
+        case OpcodeType::PrintString:
+        {
+            const auto wordCount = instruction_t::stringDataWordCount(static_cast<size_t>(instr.param()));
+            block.insert(block.end(), instructions.begin() + i, instructions.begin() + i + 1 + wordCount);
+            i += wordCount;
+            flush();
+            break;
+        }
+
+        case OpcodeType::Read:
+        case OpcodeType::Write:
+            block.push_back(instr);
+            flush();
+            break;
+
+        case OpcodeType::IfZeroSkip:
+            // The body of an IfZeroSkip returns the pointer to where it started, so what was checked before the body
+            // still holds after its EndIf whether or not the body ran.
+            touch({ instr.offset() });
+            block.push_back(instr);
+            flush();
+            ifChecked.push(checked);
+            break;
+
+        case OpcodeType::EndIf:
+            block.push_back(instr);
+            flush();
+            assert(!ifChecked.empty());
+            checked = ifChecked.top();
+            ifChecked.pop();
+            break;
+
+        default:
+            // Loops and scans end the block and move the pointer by an unknown amount.
+            block.push_back(instr);
+            flush();
+            checked = cell_range_t(0, 0);
+            break;
+        }
+    }
+
+    flush();
+    instructions = std::move(output);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Compiler::linkJumps(std::vector<instruction_t>& instructions) const
+{
+    // Upgrade each jump to a fast jump, and write the distance between matching jumps into both of them. Jumps whose
+    // distance does not fit in the instruction parameter become far jumps, which split the distance between their
+    // parameter and an extension word following each of the jumps. An IfZeroSkip only needs the distance to its
+    // EndIf, so a far IfZeroSkip is the only one of the pair with an extension word.
+    constexpr size_t MaxNearDistance = (size_t)std::numeric_limits<instruction_t::param_t>::max();
+    constexpr size_t NotAJump = (size_t)-1;
+
+    std::vector<size_t> partners(instructions.size(), NotAJump);
+    std::stack<size_t> jumps;
+
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        if (IsJumpStart(instructions[i]))
+        {
+            jumps.push(i);
+        }
+        else if (IsJumpEnd(instructions[i]))
+        {
+            assert(!jumps.empty());
+
+            partners[i] = jumps.top();
+            partners[jumps.top()] = i;
+            jumps.pop();
         }
     }
 
-    // Verify the jump stack is empty. If not, then there is an unmatched jump somewhere!
-    if (!jumps.empty())
+    assert(jumps.empty());
+
+    // Extension words push later instructions further away, which can in turn push other jumps out of range. Keep
+    // widening jumps until every near jump fits. Jumps are only ever widened so this always finishes.
+    std::vector<bool> far(instructions.size(), false);
+    std::vector<size_t> positions(instructions.size());
+    bool widened = true;
+
+    while (widened)
     {
-        throw CompileException(
-            "Unbalanced jump, expected a ] before program termination",
-            nextCharIndex - 1,
-            lineNumber,
-            columnNumber);
+        widened = false;
+
+        for (size_t i = 0, position = 0; i < instructions.size(); ++i)
+        {
+            positions[i] = position;
+            position += (far[i] ? 2 : 1);
+        }
+
+        for (size_t i = 0; i < instructions.size(); ++i)
+        {
+            if (instructions[i].isA(OpcodeType::JumpBack) &&
+                !far[i] &&
+                positions[i] - positions[partners[i]] > MaxNearDistance)
+            {
+                far[i] = far[partners[i]] = true;
+                widened = true;
+            }
+            else if (instructions[i].isA(OpcodeType::EndIf) &&
+                !far[partners[i]] &&
+                positions[i] - positions[partners[i]] > MaxNearDistance)
+            {
+                far[partners[i]] = true;
+                widened = true;
+            }
+        }
     }
 
-    // Insert end of program instruction.
-    instructions.push_back(instruction_t(OpcodeType::EndOfStream));
+    std::vector<instruction_t> output;
+    output.reserve(instructions.size());
 
-    // Remove unused space from the list of instructions before returning.
-    instructions.shrink_to_fit();
-    return instructions;
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        if (partners[i] == NotAJump || instructions[i].isA(OpcodeType::EndIf))
+        {
+            output.push_back(instructions[i]);
+            continue;
+        }
+
+        const bool isForward = IsJumpStart(instructions[i]);
+        const auto distance = isForward ? positions[partners[i]] - positions[i] : positions[i] - positions[partners[i]];
+        assert(distance > 0);
+
+        assert(distance <= instruction_t::MaxFarDistance);
+
+        if (instructions[i].isA(OpcodeType::IfZeroSkip))
+        {
+            if (far[i])
+            {
+                auto [jump, extension] =
+                    instruction_t::farJump(OpcodeType::FarIfZeroSkip, distance, instructions[i].offset());
+                output.push_back(jump);
+                output.push_back(extension);
+            }
+            else
+            {
+                output.push_back(instruction_t(
+                    OpcodeType::IfZeroSkip,
+                    static_cast<instruction_t::param_t>(distance),
+                    instructions[i].offset()));
+            }
+        }
+        else if (far[i])
+        {
+            auto [jump, extension] =
+                instruction_t::farJump(isForward ? OpcodeType::FarJumpForward : OpcodeType::FarJumpBack, distance);
+            output.push_back(jump);
+            output.push_back(extension);
+        }
+        else
+        {
+            output.push_back(instruction_t(
+                isForward ? OpcodeType::FastJumpForward : OpcodeType::FastJumpBack,
+                static_cast<instruction_t::param_t>(distance)));
+        }
+    }
+
+    instructions = std::move(output);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,171 @@
+// Copyright 2009-2020, Scott MacDonald.
+#pragma once
+#include "bf/bf.h"
+#include "bf/iconsole.h"
+#include "tape.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+
+namespace Brainfreeze
+{
+    /**
+     * Unsigned type that arithmetic on a cell is done in. Cells wrap around when they overflow, which signed types do
+     * not do, and types narrower than int would otherwise be promoted to a signed int before the arithmetic.
+     */
+    template<typename Cell>
+    using cell_arithmetic_t = decltype(std::make_unsigned_t<Cell>{} + 0u);
+
+    /** Add an amount to a cell, wrapping around at the width of the cell. */
+    template<typename Cell, typename Amount>
+    inline void AddToCell(Cell& cell, Amount amount) noexcept
+    {
+        using math_t = cell_arithmetic_t<Cell>;
+        cell = static_cast<Cell>(static_cast<math_t>(cell) + static_cast<math_t>(amount));
+    }
+
+    /** Multiply a cell value by a factor, wrapping around at the width of the cell. */
+    template<typename Cell, typename Factor>
+    inline cell_arithmetic_t<Cell> MultiplyCell(Cell cell, Factor factor) noexcept
+    {
+        using math_t = cell_arithmetic_t<Cell>;
+        return static_cast<math_t>(static_cast<math_t>(cell) * static_cast<math_t>(factor));
+    }
+
+    /**
+     * Call `function` with a value of the cell type that is `cellSize` bytes wide, so that it can instantiate code for
+     * that type. Cell sizes are validated when they are set, and anything else is treated as a one byte cell.
+     */
+    template<typename Function>
+    decltype(auto) WithCellType(std::size_t cellSize, Function&& function)
+    {
+        switch (cellSize)
+        {
+        case 2:
+            return function(int16_t{});
+
+        case 4:
+            return function(int32_t{});
+
+        case 8:
+            return function(int64_t{});
+
+        default:
+            return function(Interpreter::byte_t{});
+        }
+    }
+
+    /**
+     * Call `function` with the end of stream behavior as a std::integral_constant, so that it can instantiate code
+     * that handles the end of input without checking the behavior every time.
+     */
+    template<typename Function>
+    decltype(auto) WithEndOfStreamBehavior(Interpreter::EndOfStreamBehavior behavior, Function&& function)
+    {
+        using behavior_t = Interpreter::EndOfStreamBehavior;
+
+        switch (behavior)
+        {
+        case behavior_t::Zero:
+            return function(std::integral_constant<behavior_t, behavior_t::Zero>{});
+
+        case behavior_t::NegativeOne:
+            return function(std::integral_constant<behavior_t, behavior_t::NegativeOne>{});
+
+        case behavior_t::NoChange:
+            return function(std::integral_constant<behavior_t, behavior_t::NoChange>{});
+
+        default:
+            return function(std::integral_constant<behavior_t, behavior_t::Ignore>{});
+        }
+    }
+
+    /** Call `function` with both the cell type and the end of stream behavior, see WithCellType. */
+    template<typename Function>
+    decltype(auto) WithEnginePolicies(
+        std::size_t cellSize,
+        Interpreter::EndOfStreamBehavior behavior,
+        Function&& function)
+    {
+        return WithCellType(cellSize, [&](auto cell) -> decltype(auto) {
+            return WithEndOfStreamBehavior(behavior, [&](auto endOfStream) -> decltype(auto) {
+                return function(cell, endOfStream);
+            });
+        });
+    }
+
+    //-----------------------------------------------------------------------------------------------------------------
+    template<typename Cell, Interpreter::EndOfStreamBehavior EndOfStream>
+    Cell Interpreter::readCell(Cell current)
+    {
+        auto c = console_->read();
+
+        if (c == EOF)
+        {
+            if constexpr (EndOfStream == EndOfStreamBehavior::Zero)
+            {
+                return 0;
+            }
+            else if constexpr (EndOfStream == EndOfStreamBehavior::NegativeOne)
+            {
+                return -1;
+            }
+            else if constexpr (EndOfStream == EndOfStreamBehavior::NoChange)
+            {
+                return current;
+            }
+        }
+
+        // Bytes are unsigned so that a cell wider than a byte holds 128 to 255 rather than a negative value.
+        return static_cast<Cell>(static_cast<unsigned char>(c));
+    }
+
+    //-----------------------------------------------------------------------------------------------------------------
+    template<typename Cell>
+    std::size_t Interpreter::writeRun(const Cell* mp, std::size_t index)
+    {
+        // Writes do not change memory so the bytes for a run can be gathered before any of them are written. Very
+        // long runs are written in several blocks. Cells wider than a byte write their lowest byte.
+        constexpr std::size_t MaxBlockSize = 64;
+
+        const auto& instructions = program_->instructions();
+        char block[MaxBlockSize];
+        std::size_t count = 0;
+        std::size_t blockSize = 0;
+
+        do
+        {
+            const auto* cell = mp + instructions[index + count].offset();
+
+            if (!memory_->contains(cell))
+            {
+                // Print the cells before the one outside of memory, as separate writes would have.
+                if (blockSize > 0)
+                {
+                    console_->writeBlock(block, blockSize);
+                }
+
+                ip_ = instructions.begin() + index + count;
+                checkConsoleCell(cell);
+            }
+
+            // Cells the tape has not committed have never been touched and are zero, and reading them would fault.
+            block[blockSize++] = (memory_->isCommitted(cell) ? static_cast<char>(*cell) : '\0');
+            ++count;
+
+            if (blockSize == MaxBlockSize)
+            {
+                console_->writeBlock(block, blockSize);
+                blockSize = 0;
+            }
+        } while (instructions[index + count].isA(OpcodeType::Write));
+
+        if (blockSize > 0)
+        {
+            console_->writeBlock(block, blockSize);
+        }
+
+        return count;
+    }
+}
@@ -29,6 +29,20 @@ namespace Characters
 
 //---------------------------------------------------------------------------------------------------------------------
 std::unique_ptr<Interpreter> Brainfreeze::Helpers::LoadFromDisk(const std::string& filename)
+{
+    return LoadFromDisk(filename, Compiler());
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::unique_ptr<Interpreter> Brainfreeze::Helpers::LoadFromDisk(const std::string& filename, const Compiler& compiler)
+{
+    return std::make_unique<Interpreter>(LoadProgramFromDisk(filename, compiler));
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::shared_ptr<const Program> Brainfreeze::Helpers::LoadProgramFromDisk(
+    const std::string& filename,
+    const Compiler& compiler)
 {
     // Check that the path exists and is a file.
     if (!std::filesystem::exists(filename))
@@ -50,10 +64,8 @@ std::unique_ptr<Interpreter> Brainfreeze::Helpers::LoadFromDisk(const std::strin
     // Read the whole file into the buffer.
     stream.read(buffer.data(), size);
 
-    // Compile the code into an instruction stream, and then return an interpreter with the instruction stream loaded.
-    // TODO: Make it so the caller can pass options to the compiler.
-    Compiler compiler;
-    return std::make_unique<Interpreter>(compiler.compile(buffer));
+    // Compile the code into a program that the caller can share between interpreters.
+    return compiler.compileProgram(buffer);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -64,9 +76,9 @@ std::vector<instruction_t>::const_iterator Brainfreeze::Helpers::FindJumpTarget(
 {
     assert(jump >= begin);
     assert(jump < end);
-    assert(jump->isA(OpcodeType::JumpForward) || jump->isA(OpcodeType::JumpBack));
+    assert(IsJumpStart(*jump) || IsJumpEnd(*jump));
 
-    if (jump->isA(OpcodeType::JumpForward))
+    if (IsJumpStart(*jump))
     {
         int depth = 1;
         auto itr = jump;
@@ -78,11 +90,11 @@ std::vector<instruction_t>::const_iterator Brainfreeze::Helpers::FindJumpTarget(
             assert(itr >= begin);
             assert(itr < end);
 
-            if (itr->isA(OpcodeType::JumpForward))
+            if (IsJumpStart(*itr))
             {
                 depth++;
             }
-            else if (itr->isA(OpcodeType::JumpBack))
+            else if (IsJumpEnd(*itr))
             {
                 depth--;
             }
@@ -91,7 +103,7 @@ std::vector<instruction_t>::const_iterator Brainfreeze::Helpers::FindJumpTarget(
 
         return itr;
     }
-    else if (jump->isA(OpcodeType::JumpBack))
+    else if (IsJumpEnd(*jump))
     {
         int depth = 1;
         auto itr = jump;
@@ -103,11 +115,11 @@ std::vector<instruction_t>::const_iterator Brainfreeze::Helpers::FindJumpTarget(
             assert(itr >= begin);
             assert(itr < end);
 
-            if (itr->isA(OpcodeType::JumpForward))
+            if (IsJumpStart(*itr))
             {
                 depth--;
             }
-            else if (itr->isA(OpcodeType::JumpBack))
+            else if (IsJumpEnd(*itr))
             {
                 depth++;
             }
@@ -121,6 +133,18 @@ std::vector<instruction_t>::const_iterator Brainfreeze::Helpers::FindJumpTarget(
     }
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+bool Brainfreeze::Helpers::IsJumpStart(const instruction_t& instr) noexcept
+{
+    return instr.isA(OpcodeType::JumpForward) || instr.isA(OpcodeType::IfZeroSkip);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool Brainfreeze::Helpers::IsJumpEnd(const instruction_t& instr) noexcept
+{
+    return instr.isA(OpcodeType::JumpBack) || instr.isA(OpcodeType::EndIf);
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 bool Brainfreeze::Helpers::IsInstruction(char c) noexcept
 {
@@ -221,6 +245,36 @@ std::string Brainfreeze::Helpers::AsName(OpcodeType opcode)
         return "JumpBack";
     case OpcodeType::FastJumpBack:
         return "FastJumpBack";
+    case OpcodeType::SetZero:
+        return "SetZero";
+    case OpcodeType::SetValue:
+        return "SetValue";
+    case OpcodeType::MulAdd:
+        return "MulAdd";
+    case OpcodeType::ScanRight:
+        return "ScanRight";
+    case OpcodeType::ScanLeft:
+        return "ScanLeft";
+    case OpcodeType::FarJumpForward:
+        return "FarJumpForward";
+    case OpcodeType::FarJumpBack:
+        return "FarJumpBack";
+    case OpcodeType::PrintString:
+        return "PrintString";
+    case OpcodeType::IfZeroSkip:
+        return "IfZeroSkip";
+    case OpcodeType::EndIf:
+        return "EndIf";
+    case OpcodeType::ProductAdd:
+        return "ProductAdd";
+    case OpcodeType::Extension:
+        return "Extension";
+    case OpcodeType::FarIfZeroSkip:
+        return "FarIfZeroSkip";
+    case OpcodeType::CheckRange:
+        return "CheckRange";
+    case OpcodeType::CheckRangeIfNonZero:
+        return "CheckRangeIfNonZero";
     default:
         throw std::runtime_error("Unrecogonized opcode when converting to character");
     }
@@ -1,7 +1,36 @@
 // Copyright 2009-2020, Scott MacDonald.
 #include "bf/iconsole.h"
 
+#include <cstdio>
+
 using namespace Brainfreeze;
 
 //---------------------------------------------------------------------------------------------------------------------
 IConsole::~IConsole() = default;
+
+//---------------------------------------------------------------------------------------------------------------------
+void IConsole::writeBlock(const char* data, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        write(data[i]);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::size_t IConsole::readBlock(char* buffer, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        auto c = read();
+
+        if (c == EOF)
+        {
+            return i;
+        }
+
+        buffer[i] = c;
+    }
+
+    return size;
+}
@@ -1,5 +1,7 @@
 // Copyright 2009-2020, Scott MacDonald.
 #include "bf/bf.h"
+#include <cassert>
+#include <limits>
 #include <stdexcept>
 
 using namespace Brainfreeze;
@@ -18,14 +20,17 @@ instruction_t::instruction_t(OpcodeType op) noexcept
 
 //---------------------------------------------------------------------------------------------------------------------
 instruction_t::instruction_t(OpcodeType op, instruction_t::param_t value) noexcept
-    : data_((0x000000FF & static_cast<uint8_t>(op)) | (value << 8))
+    : instruction_t(op, value, 0)
 {
 }
 
 //---------------------------------------------------------------------------------------------------------------------
-OpcodeType instruction_t::opcode() const noexcept
+instruction_t::instruction_t(OpcodeType op, instruction_t::param_t value, instruction_t::offset_t offset) noexcept
+    : data_(
+        (0x000000FF & static_cast<uint8_t>(op)) |
+        (static_cast<uint32_t>(static_cast<uint16_t>(value)) << 8) |
+        (static_cast<uint32_t>(static_cast<uint8_t>(offset)) << 24))
 {
-    return static_cast<OpcodeType>(data_ & 0x000000FF);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -34,16 +39,10 @@ void instruction_t::setOpcode(OpcodeType op) noexcept
     data_ = (data_ & 0xFFFFFF00) | (static_cast<uint8_t>(op) & 0x000000FF);
 }
 
-//---------------------------------------------------------------------------------------------------------------------
-instruction_t::param_t instruction_t::param() const noexcept
-{
-    return static_cast<instruction_t::param_t>((data_ & 0xFFFFFF00) >> 8);
-}
-
 //---------------------------------------------------------------------------------------------------------------------
 void instruction_t::setParam(instruction_t::param_t value) noexcept
 {
-    data_ = (value << 8) | (0x000000FF & data_);
+    data_ = (static_cast<uint32_t>(static_cast<uint16_t>(value)) << 8) | (0xFF0000FF & data_);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -64,9 +63,46 @@ void instruction_t::incrementParam(instruction_t::param_t amount)
 }
 
 //---------------------------------------------------------------------------------------------------------------------
-bool instruction_t::isA(OpcodeType op) const noexcept
+void instruction_t::setOffset(instruction_t::offset_t offset) noexcept
+{
+    data_ = (static_cast<uint32_t>(static_cast<uint8_t>(offset)) << 24) | (0x00FFFFFF & data_);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+instruction_t instruction_t::extension(uint32_t value) noexcept
 {
-    return opcode() == op;
+    assert(value <= MaxExtensionValue);
+
+    instruction_t word(OpcodeType::Extension);
+    word.data_ |= value << 8;
+    return word;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::pair<instruction_t, instruction_t> instruction_t::farJump(
+    OpcodeType op,
+    uint64_t distance,
+    instruction_t::offset_t offset) noexcept
+{
+    assert(distance <= MaxFarDistance);
+
+    instruction_t jump(op, 0, offset);
+    jump.data_ |= static_cast<uint32_t>(distance >> 24) << 8;
+
+    return { jump, extension(static_cast<uint32_t>(distance & MaxExtensionValue)) };
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+instruction_t instruction_t::stringData(const char* text, std::size_t count) noexcept
+{
+    instruction_t word(OpcodeType::NoOperation);
+
+    for (std::size_t i = 0; i < count && i < StringBytesPerWord; ++i)
+    {
+        word.data_ |= static_cast<uint32_t>(static_cast<uint8_t>(text[i])) << (8 * (i + 1));
+    }
+
+    return word;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
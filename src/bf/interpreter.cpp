@@ -2,8 +2,15 @@
 #include "bf/bf.h"
 #include "bf/helpers.h"
 #include "bf/iconsole.h"
+#include "engine.h"
+#include "native_runtime.h"
+#include "scan.h"
+#include "tape.h"
+#include "threaded_engine.h"
 
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <stdexcept>
 
 using namespace Brainfreeze;
@@ -18,9 +25,30 @@ Interpreter::Interpreter(std::vector<instruction_t> instructions)
 Interpreter::Interpreter(
         std::vector<instruction_t> instructions,
         std::unique_ptr<IConsole> console)
-    : instructions_(std::move(instructions)),
+    : Interpreter(std::make_shared<const Program>(std::move(instructions)), std::move(console))
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+Interpreter::Interpreter(std::shared_ptr<const Program> program)
+    : Interpreter(std::move(program), nullptr)
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+Interpreter::Interpreter(
+        std::shared_ptr<const Program> program,
+        std::unique_ptr<IConsole> console)
+    : program_(std::move(program)),
       console_(std::move(console))
 {
+    if (program_ == nullptr)
+    {
+        throw std::runtime_error("Interpreter requires a program to run");
+    }
+
+    setCellSize(program_->cellSize());
+    setCellCount(program_->cellCount());
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -53,14 +81,79 @@ void Interpreter::setCellSize(size_t bytes)
     cellSize_ = bytes;
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+void Interpreter::setTapeMode(TapeMode mode)
+{
+    if (state_ != RunState::NotStarted)
+    {
+        throw std::runtime_error("Tape mode can only be set prior to execution");
+    }
+
+    tapeMode_ = mode;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Interpreter::setMaxMemory(std::size_t bytes)
+{
+    if (bytes == 0)
+    {
+        throw std::runtime_error("Memory limit must be at least one byte");
+    }
+
+    if (state_ != RunState::NotStarted)
+    {
+        throw std::runtime_error("Memory limit can only be set prior to execution");
+    }
+
+    maxMemory_ = bytes;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Interpreter::setExecutionEngine(ExecutionEngine engine)
+{
+    if (state_ != RunState::NotStarted)
+    {
+        throw std::runtime_error("Execution engine can only be set prior to execution");
+    }
+
+    executionEngine_ = engine;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Interpreter::setTierUpThreshold(std::size_t count)
+{
+    if (count == 0)
+    {
+        throw std::runtime_error("Tier up threshold must be at least one");
+    }
+
+    tierUpThreshold_ = count;
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 void Interpreter::start()
 {
     // TODO: If console required check that it is defined.
     assert(console_ != nullptr);
-    memory_.resize(cellCount_ * cellSize_, 0);
-    mp_ = memory_.begin();
-    ip_ = instructions_.begin();
+
+    // Engines check the cells they touch against the edges of memory, so the guard regions only back those checks up.
+    constexpr std::size_t GuardCellCount = 1024 * 1024;
+
+    if (tapeMode_ == TapeMode::Growing)
+    {
+        memory_ = Tape::createGrowing(maxMemory_, GuardCellCount * cellSize_);
+    }
+    else if (tapeMode_ == TapeMode::Sparse)
+    {
+        memory_ = Tape::createSparse(cellCount_ * cellSize_, maxMemory_, GuardCellCount * cellSize_);
+    }
+    else
+    {
+        memory_ = std::make_unique<Tape>(cellCount_ * cellSize_, GuardCellCount * cellSize_);
+    }
+
+    mp_ = memory_->data();
+    ip_ = program_->instructions().begin();
 
     state_ = RunState::Running;
 }
@@ -70,131 +163,469 @@ void Interpreter::run()
 {
     start();
 
-    // Keep executing instructions until the end of the instruction stream is reached.
-    while (state_ == RunState::Running)
-    {
-        runStep();
-    }
+    // Engines check the memory pointer and the cells touched at an offset from it, so a fault only happens when a
+    // growing or sparse tape cannot commit the page touched. The engine is abandoned with a non-local jump, which is
+    // why console I/O never touches uncommitted memory (see Tape::runGuarded). A fault leaves the engine without
+    // syncing its pointers, so the memory pointer is set to the cell that was touched and the instruction pointer stays
+    // where the engine last synced it.
+    auto onFault = [this](const void* address) {
+        const auto cell = reinterpret_cast<std::uintptr_t>(address) & ~static_cast<std::uintptr_t>(cellSize_ - 1);
+        mp_ = reinterpret_cast<byte_t*>(cell);
+    };
+
+    memory_->runGuarded([this]() {
+        switch (executionEngine_)
+        {
+        case ExecutionEngine::Threaded:
+            runThreaded();
+            break;
+
+        case ExecutionEngine::Jit:
+            runJit();
+            break;
+
+        case ExecutionEngine::Tiered:
+            runTiered();
+            break;
+
+        case ExecutionEngine::Basic:
+        default:
+            runBasic();
+            break;
+        }
+    }, onFault);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
-Interpreter::RunState Interpreter::runStep()
+void Interpreter::runBasic()
+{
+    // Keep executing instructions until the end of the instruction stream is reached, using the engine specialised for
+    // the cell size and end of stream behavior.
+    WithEnginePolicies(cellSize_, endOfStreamBehavior_, [this](auto cell, auto endOfStream) {
+        execute<decltype(cell), decltype(endOfStream)::value, false, false>();
+    });
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Interpreter::runTiered()
 {
     assert(state_ == RunState::Running);
-    assert(ip_ < instructions_.end());
 
-    switch (ip_->opcode())
+    // Without native code support tiered execution is the same as the basic engine. Native code only works with one
+    // byte cells.
+    if (!Jit::IsSupported() || cellSize_ != sizeof(byte_t))
     {
-    case OpcodeType::PtrInc:
-        assert(ip_->param() < memory_.end() - mp_);     // TODO: Test this boundary condition. MAYBE?
-        mp_ += ip_->param();
-        break;
+        runBasic();
+        return;
+    }
+
+    nativeRuntime_ = std::make_unique<native_runtime_t>(*this);
+    nativeRuntime_->backEdgeCounts.assign(program_->instructions().size(), 0);
+    nativeRuntime_->loopEntries.assign(program_->instructions().size(), nullptr);
 
-    case OpcodeType::PtrDec:
-        assert(ip_->param() <= mp_ - memory_.begin());
-        mp_ -= ip_->param();
-        break;
-    
-    case OpcodeType::MemInc:
-        // TODO: Handle configurable memory blocks larger than 1 byte.
-        // TODO: How should overflow be handled?
-        *mp_ += static_cast<byte_t>(ip_->param());
-        break;
+    WithEndOfStreamBehavior(endOfStreamBehavior_, [this](auto endOfStream) {
+        execute<byte_t, decltype(endOfStream)::value, false, true>();
+    });
+}
 
-    case OpcodeType::MemDec:
-        // TODO: Handle configurable memory blocks larger than 1 byte.
-        // TODO: How should overflow be handled?
-        *mp_ -= static_cast<byte_t>(ip_->param());
-        break;
+//---------------------------------------------------------------------------------------------------------------------
+Interpreter::RunState Interpreter::runStep()
+{
+    return WithEnginePolicies(cellSize_, endOfStreamBehavior_, [this](auto cell, auto endOfStream) {
+        return execute<decltype(cell), decltype(endOfStream)::value, true, false>();
+    });
+}
 
-    case OpcodeType::Write:
-        console_->write(*mp_);
-        break;
+//---------------------------------------------------------------------------------------------------------------------
+template<typename Cell, Interpreter::EndOfStreamBehavior EndOfStream, bool SingleStep, bool Tiered>
+Interpreter::RunState Interpreter::execute()
+{
+    static_assert(!Tiered || std::is_same_v<Cell, byte_t>, "native code only supports one byte cells");
+
+    const auto& instructions = program_->instructions();
 
-    case OpcodeType::Read:
+    assert(state_ == RunState::Running);
+    assert(ip_ < instructions.end());
+    assert(!Tiered || nativeRuntime_ != nullptr);
+    assert(cellSize_ == sizeof(Cell));
+
+    // Keep the instruction pointer, memory pointer and tape base in locals for the duration of the loop so they can
+    // live in registers rather than being reloaded through `this` on every instruction. Memory is allocated as bytes
+    // and accessed as cells.
+    const auto* const code = instructions.data();
+    auto* const tape = reinterpret_cast<Cell*>(memory_->begin());
+    auto* const tapeEnd = reinterpret_cast<Cell*>(memory_->end());
+    const auto* ip = code + (ip_ - instructions.begin());
+    auto* mp = reinterpret_cast<Cell*>(mp_);
+
+    // Copy the local pointers back into the interpreter. This must happen before anything that can observe them, which
+    // is console callbacks, exceptions and the end of execution.
+    auto syncState = [&]() {
+        ip_ = instructions.begin() + (ip - code);
+        mp_ = reinterpret_cast<byte_t*>(mp);
+    };
+
+    for (;;)
     {
-        auto c = console_->read();
+        assert(ip < code + instructions.size());
 
-        if (c == EOF)
+        switch (ip->opcode())
         {
-            switch (endOfStreamBehavior_)
+        case OpcodeType::PtrInc:
+            // Moves are checked so the memory pointer never leaves memory. Cells touched at an offset from it are
+            // covered by the range checks the compiler puts at the start of each block.
+            if (ip->param() >= tapeEnd - mp)
+            {
+                syncState();
+                throw std::runtime_error("Memory pointer moved past the end of memory");
+            }
+
+            mp += ip->param();
+            break;
+
+        case OpcodeType::PtrDec:
+            if (ip->param() > mp - tape)
             {
-            case Interpreter::EndOfStreamBehavior::Zero:
-                c = 0;
-                break;
+                syncState();
+                throw std::runtime_error("Memory pointer moved past the start of memory");
+            }
 
-            case Interpreter::EndOfStreamBehavior::NegativeOne:
-                c = (byte_t)-1;
-                break;
+            mp -= ip->param();
+            break;
 
-            case Interpreter::EndOfStreamBehavior::NoChange:
-                c = *mp_;
+        case OpcodeType::MemInc:
+            // Cells wrap around when they overflow.
+            AddToCell(mp[ip->offset()], ip->param());
+            break;
 
-            default: // Use whatever was returned.
-                break;
+        case OpcodeType::MemDec:
+            AddToCell(mp[ip->offset()], -ip->param());
+            break;
+
+        case OpcodeType::SetZero:
+        case OpcodeType::SetValue:
+            // Clear loops store their final value directly, which is zero for SetZero.
+            mp[ip->offset()] = static_cast<Cell>(ip->param());
+            break;
+
+        case OpcodeType::MulAdd:
+            // Multiply loops do not run when the loop cell is zero, so skip touching the target cell which may not
+            // be a valid memory location.
+            if (*mp != 0)
+            {
+                AddToCell(mp[ip->offset()], MultiplyCell(*mp, ip->param()));
             }
-        }
-        
-        *mp_ = c;
-        break;
-    }
+            break;
 
-    case OpcodeType::JumpForward:
-        // Only execute if byte at data pointer is zero
-        if (*mp_ == 0)
-        {
-            ip_ = Helpers::FindJumpTarget(instructions_.begin(), instructions_.end(), ip_);
-        }
+        case OpcodeType::ProductAdd:
+            // Like MulAdd with a second factor, which is the cell at the offset held by the no-op word that follows.
+            // The word is skipped.
+            if (*mp != 0)
+            {
+                AddToCell(mp[ip->offset()], MultiplyCell(*mp, MultiplyCell(mp[ip[1].offset()], ip->param())));
+            }
 
-        break;
+            ip++;
+            break;
 
-    case OpcodeType::JumpBack:
-        // Only execute if byte at data pointer is non-zero
-        if (*mp_ != 0)
-        {
-            ip_ = Helpers::FindJumpTarget(instructions_.begin(), instructions_.end(), ip_);
+        case OpcodeType::CheckRange:
+        case OpcodeType::CheckRangeIfNonZero:
+            // The range of offsets is from the offset to the parameter, and only matters to multiply loops when the
+            // current cell is non-zero.
+            if (ip->isA(OpcodeType::CheckRange) || *mp != 0)
+            {
+                if (ip->offset() < tape - mp)
+                {
+                    syncState();
+                    throw std::runtime_error("Memory pointer moved past the start of memory");
+                }
+                else if (ip->param() >= tapeEnd - mp)
+                {
+                    syncState();
+                    throw std::runtime_error("Memory pointer moved past the end of memory");
+                }
+            }
+            break;
+
+        case OpcodeType::ScanRight:
+            if (auto found = ScanRight(mp, tapeEnd, ip->param()); found != nullptr)
+            {
+                mp = found;
+            }
+            else
+            {
+                syncState();
+                throw std::runtime_error("Scan moved the memory pointer past the end of memory");
+            }
+            break;
+
+        case OpcodeType::ScanLeft:
+            if (auto found = ScanLeft(mp, tape, ip->param()); found != nullptr)
+            {
+                mp = found;
+            }
+            else
+            {
+                syncState();
+                throw std::runtime_error("Scan moved the memory pointer past the start of memory");
+            }
+            break;
+
+        case OpcodeType::Write:
+            syncState();
+
+            if constexpr (SingleStep)
+            {
+                checkConsoleCell(mp + ip->offset());
+                console_->write(memory_->isCommitted(mp + ip->offset()) ? static_cast<char>(mp[ip->offset()]) : '\0');
+            }
+            else
+            {
+                ip += writeRun(mp, ip - code) - 1;
+            }
+            break;
+
+        case OpcodeType::Read:
+            syncState();
+            commitConsoleCell(mp + ip->offset());
+            mp[ip->offset()] = readCell<Cell, EndOfStream>(mp[ip->offset()]);
+            break;
+
+        case OpcodeType::PrintString:
+            // Skip the data words that hold the text.
+            syncState();
+            ip += printString(ip - code) - 1;
+            break;
+
+        case OpcodeType::JumpForward:
+            // Only execute if byte at data pointer is zero
+            if (*mp == 0)
+            {
+                auto target = Helpers::FindJumpTarget(
+                    instructions.begin(),
+                    instructions.end(),
+                    instructions.begin() + (ip - code));
+                ip = code + (target - instructions.begin());
+            }
+            break;
+
+        case OpcodeType::JumpBack:
+            // Only execute if byte at data pointer is non-zero
+            if (*mp != 0)
+            {
+                auto target = Helpers::FindJumpTarget(
+                    instructions.begin(),
+                    instructions.end(),
+                    instructions.begin() + (ip - code));
+                ip = code + (target - instructions.begin());
+            }
+            break;
+
+        case OpcodeType::FastJumpForward:
+            // Only execute if byte at data pointer is zero
+            if (*mp == 0)
+            {
+                assert(ip->param() > 0);
+                ip += ip->param();
+            }
+            else if constexpr (Tiered)
+            {
+                // Run the whole loop natively if it has already been compiled, and continue from its ].
+                if (auto entry = nativeRuntime_->loopEntries[ip - code]; entry != nullptr)
+                {
+                    mp = nativeRuntime_->run(entry, mp);
+                    ip += ip->param();
+                }
+            }
+            break;
+
+        case OpcodeType::FastJumpBack:
+            // Only execute if byte at data pointer is non-zero
+            if (*mp != 0)
+            {
+                assert(ip->param() > 0);
+                ip -= ip->param();
+
+                if constexpr (Tiered)
+                {
+                    // Compile the loop once it gets hot, and then switch to native code at the loop's [ since the
+                    // loop is about to run again.
+                    const auto head = static_cast<std::size_t>(ip - code);
+
+                    if (++nativeRuntime_->backEdgeCounts[head] == tierUpThreshold_)
+                    {
+                        nativeRuntime_->compileLoop(head);
+                    }
+
+                    if (auto entry = nativeRuntime_->loopEntries[head]; entry != nullptr)
+                    {
+                        mp = nativeRuntime_->run(entry, mp);
+                        ip += ip->param();
+                    }
+                }
+            }
+            break;
+
+        case OpcodeType::FarJumpForward:
+            // The distance to the matching jump is split with the extension word that follows, which is skipped.
+            if (*mp == 0)
+            {
+                ip += ip->farDistance(ip[1]);
+            }
+
+            ip++;
+            break;
+
+        case OpcodeType::FarJumpBack:
+            if (*mp != 0)
+            {
+                ip -= ip->farDistance(ip[1]);
+            }
+
+            ip++;
+            break;
+
+        case OpcodeType::IfZeroSkip:
+            // The body always leaves its cell zero so it runs at most once, and there is no jump back from EndIf.
+            // Programs that were not linked are searched for the matching EndIf like a jump that was not linked.
+            if (mp[ip->offset()] == 0)
+            {
+                if (ip->param() > 0)
+                {
+                    ip += ip->param();
+                }
+                else
+                {
+                    auto target = Helpers::FindJumpTarget(
+                        instructions.begin(),
+                        instructions.end(),
+                        instructions.begin() + (ip - code));
+                    ip = code + (target - instructions.begin());
+                }
+            }
+            break;
+
+        case OpcodeType::FarIfZeroSkip:
+            // The distance to the EndIf is split with the extension word that follows, which is skipped.
+            if (mp[ip->offset()] == 0)
+            {
+                ip += ip->farDistance(ip[1]);
+            }
+            else
+            {
+                ip++;
+            }
+            break;
+
+        case OpcodeType::EndIf:
+            break;
+
+        case OpcodeType::EndOfStream:
+            // Immediately return when end of stream is reached to prevent instruction pointer from being incremented
+            // or other such nonsense.
+            syncState();
+            state_ = RunState::Finished;
+            return RunState::Finished;
+
+        default:
+            syncState();
+            throw std::runtime_error("unknown instruction opcode");
         }
-        break;
 
-    case OpcodeType::FastJumpForward:
-        // Only execute if byte at data pointer is zero
-        if (*mp_ == 0)
+        // Move to the next instruction.
+        ip++;
+
+        if constexpr (SingleStep)
         {
-            assert(ip_->param() > 0);
-            ip_ += ip_->param();
+            syncState();
+            return state_;
         }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Interpreter::checkConsoleCell(const void* cell) const
+{
+    if (cell < memory_->begin())
+    {
+        throw std::runtime_error("Memory pointer moved past the start of memory");
+    }
+    else if (!memory_->contains(cell))
+    {
+        throw std::runtime_error("Memory pointer moved past the end of memory");
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Interpreter::commitConsoleCell(void* cell)
+{
+    checkConsoleCell(cell);
+
+    if (!memory_->isCommitted(cell) && memory_->handleFault(cell) == Tape::Fault::OutOfMemory)
+    {
+        throw std::runtime_error("Memory limit exceeded");
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::size_t Interpreter::printString(std::size_t index)
+{
+    const auto& instructions = program_->instructions();
+    assert(instructions[index].isA(OpcodeType::PrintString));
 
-        break;
+    // Unpack the text from the data words into a block, and write it in several blocks if it is very long.
+    constexpr std::size_t MaxBlockSize = 1024;
+    constexpr std::size_t BytesPerWord = instruction_t::StringBytesPerWord;
 
-    case OpcodeType::FastJumpBack:
-        // Only execute if byte at data pointer is non-zero
-        if (*mp_ != 0)
+    const auto length = static_cast<std::size_t>(instructions[index].param());
+    const auto* words = instructions.data() + index + 1;
+
+    char block[MaxBlockSize];
+    std::size_t blockSize = 0;
+
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        block[blockSize++] = words[i / BytesPerWord].stringByte(i % BytesPerWord);
+
+        if (blockSize == MaxBlockSize)
         {
-            assert(ip_->param() > 0);
-            ip_ -= ip_->param();
+            console_->writeBlock(block, blockSize);
+            blockSize = 0;
         }
-        break;
-
-    case OpcodeType::EndOfStream:
-        // Immediately return when end of stream is reached to prevent instruction pointer from being incremented or
-        // other such nonsense.
-        state_ = RunState::Finished;
-        return RunState::Finished;
+    }
 
-    default:
-        throw std::runtime_error("unknown instruction opcode");
+    if (blockSize > 0)
+    {
+        console_->writeBlock(block, blockSize);
     }
 
-    // Move to the next instruction and then return the running state of the interpreter.
-    ip_++;
-    return state_;
+    return 1 + instruction_t::stringDataWordCount(length);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 Interpreter::byte_t Interpreter::memoryAt(std::size_t offset) const
 {
-    assert(offset < memory_.size());
-    return memory_[offset];
+    return static_cast<byte_t>(cellAt(offset));
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+int64_t Interpreter::cellAt(std::size_t address) const
+{
+    assert(memory_ != nullptr);
+
+    const auto* bytes = memory_->data() + address * cellSize_;
+    assert(bytes + cellSize_ <= memory_->end());
+
+    // Memory that a growing tape has not committed yet has never been touched, so it is zero but cannot be read.
+    if (!memory_->isCommitted(bytes))
+    {
+        return 0;
+    }
+
+    return WithCellType(cellSize_, [&](auto cell) -> int64_t {
+        std::memcpy(&cell, bytes, sizeof(cell));
+        return cell;
+    });
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -202,11 +633,11 @@ Interpreter::instruction_pointer_t Interpreter::instructionPointer() const
 {
     // TODO: Remove
     // ip_ - instructions_.begin()
-    return instruction_pointer_t(instructions_.begin(), ip_);
+    return instruction_pointer_t(program_->instructions().begin(), ip_);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 Interpreter::memory_pointer_t Interpreter::memoryPointer() const
 {
-    return memory_pointer_t(memory_.begin(), mp_);
+    return memory_pointer_t(memory_ != nullptr ? memory_->data() : nullptr, mp_, cellSize_);
 }
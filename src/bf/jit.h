@@ -0,0 +1,85 @@
+// Copyright 2009-2020, Scott MacDonald.
+#pragma once
+#include "bf/instruction.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace Brainfreeze::Jit
+{
+    /**
+     * Callback invoked by native code for instructions it cannot perform itself (console reads and writes). The
+     * callback receives the opaque context passed to the native entry point, the current memory pointer and the
+     * index of the instruction being executed. It returns zero on success, or non-zero to abort native execution.
+     */
+    using runtime_callback_t = int (*)(void* context, int8_t* memoryPointer, uint32_t instructionIndex);
+
+    /**
+     * Callback invoked by native code to run a scan instruction. Takes the same arguments as a runtime callback, and
+     * returns the new memory pointer or null to abort native execution.
+     */
+    using scan_callback_t = int8_t* (*)(void* context, int8_t* memoryPointer, uint32_t instructionIndex);
+
+    /**
+     * Native code entry point. Takes the memory pointer, an opaque context that is passed to runtime callbacks and the
+     * bounds of memory which inline scans stay within. Returns the memory pointer after execution finished, or null if
+     * a runtime callback aborted execution.
+     */
+    using entry_point_t = int8_t* (*)(
+        int8_t* memoryPointer,
+        void* context,
+        const int8_t* memoryBegin,
+        const int8_t* memoryEnd);
+
+    /** Runtime functions that native code calls out to. */
+    struct runtime_callbacks_t
+    {
+        runtime_callback_t write = nullptr;
+        runtime_callback_t read = nullptr;
+        scan_callback_t scanRight = nullptr;
+        scan_callback_t scanLeft = nullptr;
+        runtime_callback_t moveOutOfBounds = nullptr;   ///< Reports a move or range check that would leave memory.
+    };
+
+    /** Owns a block of executable memory holding native code generated by the JIT. */
+    class NativeCode
+    {
+    public:
+        /** Copy machine code into newly allocated executable memory. */
+        NativeCode(const uint8_t* code, std::size_t size);
+
+        /** Destructor, releases the executable memory. */
+        ~NativeCode();
+
+        /** Get the entry point of the native code. */
+        entry_point_t entryPoint() const noexcept;
+
+        /** Get the size of the native code in bytes. */
+        std::size_t size() const noexcept { return size_; }
+
+        NativeCode(const NativeCode&) = delete;
+        NativeCode& operator =(const NativeCode&) = delete;
+
+    private:
+        void* memory_ = nullptr;
+        std::size_t size_ = 0;
+        std::size_t mappedSize_ = 0;
+    };
+
+    /** Check if the JIT can generate and run native code on this host. */
+    bool IsSupported() noexcept;
+
+    /**
+     * Compile a balanced range of instructions into native code. Execution starts at the first instruction and
+     * returns when it runs past the last instruction or reaches an end of stream instruction. The instruction index
+     * passed to runtime callbacks is firstIndex plus the position of the instruction in the range.
+     *
+     * Returns null if the host is not supported or executable memory could not be allocated.
+     */
+    std::unique_ptr<NativeCode> Compile(
+        const instruction_t* begin,
+        const instruction_t* end,
+        uint32_t firstIndex,
+        const runtime_callbacks_t& callbacks);
+}
@@ -0,0 +1,213 @@
+// Copyright 2009-2020, Scott MacDonald.
+#include "bf/bf.h"
+#include "bf/iconsole.h"
+#include "engine.h"
+#include "native_runtime.h"
+#include "scan.h"
+#include "tape.h"
+
+#include <cassert>
+#include <exception>
+#include <stdexcept>
+
+using namespace Brainfreeze;
+
+//---------------------------------------------------------------------------------------------------------------------
+Interpreter::native_runtime_t::native_runtime_t(Interpreter& interpreter)
+    : self(interpreter)
+{
+    callbacks.write = &native_runtime_t::write;
+    callbacks.read = WithEndOfStreamBehavior(interpreter.endOfStreamBehavior_, [](auto endOfStream) {
+        return &native_runtime_t::read<decltype(endOfStream)::value>;
+    });
+    callbacks.scanRight = &native_runtime_t::scanRight;
+    callbacks.scanLeft = &native_runtime_t::scanLeft;
+    callbacks.moveOutOfBounds = &native_runtime_t::moveOutOfBounds;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+Interpreter::byte_t* Interpreter::native_runtime_t::run(Jit::entry_point_t entry, byte_t* mp)
+{
+    assert(entry != nullptr);
+    auto result = entry(mp, this, self.memory_->begin(), self.memory_->end());
+
+    if (result == nullptr)
+    {
+        // A runtime callback failed after syncing the interpreter's pointers, so rethrow its exception.
+        assert(error != nullptr);
+        auto e = error;
+        error = nullptr;
+
+        std::rethrow_exception(e);
+    }
+
+    return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Interpreter::native_runtime_t::compileLoop(std::size_t headIndex)
+{
+    const auto* head = self.program_->instructions().data() + headIndex;
+    assert(head->isA(OpcodeType::FastJumpForward));
+
+    auto code = Jit::Compile(head, head + head->param() + 1, static_cast<uint32_t>(headIndex), callbacks);
+
+    if (code != nullptr)
+    {
+        loopEntries[headIndex] = code->entryPoint();
+        loopCode.push_back(std::move(code));
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+int Interpreter::native_runtime_t::write(void* context, int8_t* mp, uint32_t index)
+{
+    // Sync the interpreter's pointers before touching the console so they are correct if the console throws, and
+    // capture any exception because it cannot be unwound through native code.
+    auto runtime = static_cast<native_runtime_t*>(context);
+    auto& self = runtime->self;
+
+    try
+    {
+        self.ip_ = self.program_->instructions().begin() + index;
+        self.mp_ = mp;
+
+        if (self.program_->instructions()[index].isA(OpcodeType::PrintString))
+        {
+            self.printString(index);
+        }
+        else
+        {
+            self.writeRun(mp, index);
+        }
+
+        return 0;
+    }
+    catch (...)
+    {
+        runtime->error = std::current_exception();
+        return 1;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+template<Interpreter::EndOfStreamBehavior EndOfStream>
+int Interpreter::native_runtime_t::read(void* context, int8_t* mp, uint32_t index)
+{
+    auto runtime = static_cast<native_runtime_t*>(context);
+    auto& self = runtime->self;
+
+    try
+    {
+        self.ip_ = self.program_->instructions().begin() + index;
+        self.mp_ = mp;
+        auto cell = mp + self.program_->instructions()[index].offset();
+        self.commitConsoleCell(cell);
+        *cell = self.readCell<byte_t, EndOfStream>(*cell);
+        return 0;
+    }
+    catch (...)
+    {
+        runtime->error = std::current_exception();
+        return 1;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+int8_t* Interpreter::native_runtime_t::scanRight(void* context, int8_t* mp, uint32_t index)
+{
+    auto runtime = static_cast<native_runtime_t*>(context);
+    auto& self = runtime->self;
+    auto stride = static_cast<std::size_t>(self.program_->instructions()[index].param());
+
+    if (auto found = ScanRight(mp, self.memory_->end(), stride); found != nullptr)
+    {
+        return found;
+    }
+
+    self.ip_ = self.program_->instructions().begin() + index;
+    self.mp_ = mp;
+    runtime->error = std::make_exception_ptr(
+        std::runtime_error("Scan moved the memory pointer past the end of memory"));
+    return nullptr;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+int8_t* Interpreter::native_runtime_t::scanLeft(void* context, int8_t* mp, uint32_t index)
+{
+    auto runtime = static_cast<native_runtime_t*>(context);
+    auto& self = runtime->self;
+    auto stride = static_cast<std::size_t>(self.program_->instructions()[index].param());
+
+    if (auto found = ScanLeft(mp, self.memory_->begin(), stride); found != nullptr)
+    {
+        return found;
+    }
+
+    self.ip_ = self.program_->instructions().begin() + index;
+    self.mp_ = mp;
+    runtime->error = std::make_exception_ptr(
+        std::runtime_error("Scan moved the memory pointer past the start of memory"));
+    return nullptr;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+int Interpreter::native_runtime_t::moveOutOfBounds(void* context, int8_t* mp, uint32_t index)
+{
+    auto runtime = static_cast<native_runtime_t*>(context);
+    auto& self = runtime->self;
+
+    const auto& instr = self.program_->instructions()[index];
+    const bool isPastStart = instr.isA(OpcodeType::PtrDec) ||
+        (!instr.isA(OpcodeType::PtrInc) && mp + instr.offset() < self.memory_->begin());
+
+    self.ip_ = self.program_->instructions().begin() + index;
+    self.mp_ = mp;
+    runtime->error = std::make_exception_ptr(std::runtime_error(
+        isPastStart ?
+            "Memory pointer moved past the start of memory" :
+            "Memory pointer moved past the end of memory"));
+    return 1;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Interpreter::runJit()
+{
+    assert(state_ == RunState::Running);
+
+    // Native code is only generated on supported hosts, and only for one byte cells. Everywhere else the threaded
+    // engine is the fastest option.
+    if (!Jit::IsSupported() || cellSize_ != sizeof(byte_t))
+    {
+        runThreaded();
+        return;
+    }
+
+    nativeRuntime_ = std::make_unique<native_runtime_t>(*this);
+
+    // Compile the remainder of the program. Fall back to the threaded engine if native code could not be created.
+    const auto& instructions = program_->instructions();
+    const auto startIndex = static_cast<uint32_t>(ip_ - instructions.begin());
+
+    nativeRuntime_->programCode = Jit::Compile(
+        instructions.data() + startIndex,
+        instructions.data() + instructions.size(),
+        startIndex,
+        nativeRuntime_->callbacks);
+
+    if (nativeRuntime_->programCode == nullptr)
+    {
+        runThreaded();
+        return;
+    }
+
+    auto mp = nativeRuntime_->run(
+        nativeRuntime_->programCode->entryPoint(),
+        mp_);
+
+    // Native code only returns normally after reaching the end of stream instruction.
+    assert(program_->instructions().back().isA(OpcodeType::EndOfStream));
+    ip_ = program_->instructions().end() - 1;
+    mp_ = mp;
+    state_ = RunState::Finished;
+}
@@ -0,0 +1,612 @@
+// Copyright 2009-2020, Scott MacDonald.
+#include "jit.h"
+#include "scan.h"
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// The x86-64 backend uses the System V calling convention and POSIX memory mapping, so it is only enabled on 64 bit
+// x86 hosts that are not Windows. Everywhere else IsSupported() returns false and callers fall back to interpreting.
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(_WIN32)
+#   define BF_JIT_X64 1
+#   include <sys/mman.h>
+#   include <unistd.h>
+#else
+#   define BF_JIT_X64 0
+#endif
+
+using namespace Brainfreeze;
+using namespace Brainfreeze::Jit;
+
+namespace
+{
+    /** Append-only buffer of machine code with support for patching 32 bit relative jump displacements. */
+    class CodeBuffer
+    {
+    public:
+        void emit8(uint8_t v) { code_.push_back(v); }
+
+        void emit(std::initializer_list<uint8_t> bytes) { code_.insert(code_.end(), bytes); }
+
+        void emit32(uint32_t v)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                code_.push_back(static_cast<uint8_t>(v >> (i * 8)));
+            }
+        }
+
+        void emit64(uint64_t v)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                code_.push_back(static_cast<uint8_t>(v >> (i * 8)));
+            }
+        }
+
+        /** Write the displacement from the end of a rel32 field at `at` to `target`. */
+        void patchRel32(std::size_t at, std::size_t target)
+        {
+            auto rel = static_cast<int32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(at + 4));
+            std::memcpy(code_.data() + at, &rel, sizeof(rel));
+        }
+
+        std::size_t size() const noexcept { return code_.size(); }
+        const uint8_t* data() const noexcept { return code_.data(); }
+
+    private:
+        std::vector<uint8_t> code_;
+    };
+
+    // Register assignment:
+    //   rbx - memory pointer (callee saved so it survives runtime callbacks).
+    //   r12 - opaque runtime context passed to callbacks.
+    //   r13 - first byte of memory, the lower bound for pointer moves and inline scans.
+    //   r14 - one past the last byte of memory, the upper bound for pointer moves and inline scans.
+    //   rbp - saved only to keep the stack 16 byte aligned at call sites.
+
+    /** Number of steps a scan takes in native code before calling out to the vectorized scan functions. */
+    constexpr int InlineScanSteps = 4;
+
+    /**
+     * Emit a move of the memory pointer that stays within memory. A move that would leave memory jumps to an out of
+     * line stub instead, and the rel32 field of that jump is recorded along with the instruction index so the stub
+     * can be emitted later.
+     */
+    void EmitMovePointer(
+        CodeBuffer& code,
+        int32_t amount,
+        uint32_t index,
+        std::vector<std::pair<std::size_t, uint32_t>>& outOfBounds)
+    {
+        if (amount >= -128 && amount <= 127)
+        {
+            code.emit({ 0x48, 0x8D, 0x43 });                        // lea rax, [rbx + disp8]
+            code.emit8(static_cast<uint8_t>(amount));
+        }
+        else
+        {
+            code.emit({ 0x48, 0x8D, 0x83 });                        // lea rax, [rbx + disp32]
+            code.emit32(static_cast<uint32_t>(amount));
+        }
+
+        if (amount > 0)
+        {
+            code.emit({ 0x4C, 0x39, 0xF0 });                        // cmp rax, r14
+            code.emit({ 0x0F, 0x83 });                              // jae out of bounds
+        }
+        else
+        {
+            code.emit({ 0x4C, 0x39, 0xE8 });                        // cmp rax, r13
+            code.emit({ 0x0F, 0x82 });                              // jb out of bounds
+        }
+
+        outOfBounds.emplace_back(code.size(), index);
+        code.emit32(0);
+        code.emit({ 0x48, 0x89, 0xC3 });                            // mov rbx, rax
+    }
+
+    /**
+     * Emit a check that the cells from `low` to `high` cells away from the memory pointer are in memory, which jumps to
+     * the out of bounds stub for the instruction if they are not. The cell at the memory pointer is always in memory
+     * so only the ends of the range that reach past it are checked.
+     */
+    void EmitCheckRange(
+        CodeBuffer& code,
+        int32_t low,
+        int32_t high,
+        uint32_t index,
+        std::vector<std::pair<std::size_t, uint32_t>>& outOfBounds)
+    {
+        if (low < 0)
+        {
+            code.emit({ 0x48, 0x8D, 0x43 });                        // lea rax, [rbx + disp8]
+            code.emit8(static_cast<uint8_t>(low));
+            code.emit({ 0x4C, 0x39, 0xE8 });                        // cmp rax, r13
+            code.emit({ 0x0F, 0x82 });                              // jb out of bounds
+            outOfBounds.emplace_back(code.size(), index);
+            code.emit32(0);
+        }
+
+        if (high > 0)
+        {
+            code.emit({ 0x48, 0x8D, 0x83 });                        // lea rax, [rbx + disp32]
+            code.emit32(static_cast<uint32_t>(high));
+            code.emit({ 0x4C, 0x39, 0xF0 });                        // cmp rax, r14
+            code.emit({ 0x0F, 0x83 });                              // jae out of bounds
+            outOfBounds.emplace_back(code.size(), index);
+            code.emit32(0);
+        }
+    }
+
+    /** Emit a call to a runtime or scan callback with the context, memory pointer and instruction index. */
+    void EmitCall(CodeBuffer& code, const void* callback, uint32_t index)
+    {
+        code.emit({ 0x4C, 0x89, 0xE7 });                            // mov rdi, r12
+        code.emit({ 0x48, 0x89, 0xDE });                            // mov rsi, rbx
+        code.emit8(0xBA);                                           // mov edx, imm32
+        code.emit32(index);
+        code.emit({ 0x48, 0xB8 });                                  // mov rax, imm64
+        code.emit64(reinterpret_cast<uint64_t>(callback));
+        code.emit({ 0xFF, 0xD0 });                                  // call rax
+    }
+
+    /** Emit a call to a runtime callback followed by a jump to the abort path if it fails. */
+    void EmitCallback(CodeBuffer& code, runtime_callback_t callback, uint32_t index, std::vector<std::size_t>& aborts)
+    {
+        EmitCall(code, reinterpret_cast<const void*>(callback), index);
+        code.emit({ 0x85, 0xC0 });                                  // test eax, eax
+        code.emit({ 0x0F, 0x85 });                                  // jnz abort
+        aborts.push_back(code.size());
+        code.emit32(0);
+    }
+
+    /**
+     * Emit a scan that moves the memory pointer to the nearest zero cell. Scans with a large stride gain nothing from
+     * the vector search so they loop entirely in native code. Other scans take their first few steps inline since
+     * most scans are short, and then call out to the scan callback. Scans that reach the edge of memory always call
+     * the scan callback so it can report the error.
+     */
+    void EmitScan(
+        CodeBuffer& code,
+        scan_callback_t callback,
+        int32_t step,
+        uint32_t index,
+        std::vector<std::size_t>& aborts)
+    {
+        const bool loopInline = static_cast<std::size_t>(step < 0 ? -step : step) >= VectorScanStrideLimit;
+        std::vector<std::size_t> found;
+        std::vector<std::size_t> slow;
+
+        code.emit({ 0x48, 0x89, 0xD8 });                            // mov rax, rbx
+        code.emit({ 0x80, 0x38, 0x00 });                            // cmp byte [rax], 0
+        code.emit({ 0x0F, 0x84 });                                  // jz found
+        found.push_back(code.size());
+        code.emit32(0);
+
+        const auto loopStart = code.size();
+        const int steps = (loopInline ? 1 : InlineScanSteps);
+
+        for (int i = 0; i < steps; ++i)
+        {
+            if (step >= -128 && step <= 127)
+            {
+                code.emit({ 0x48, 0x83, 0xC0 });                    // add rax, imm8
+                code.emit8(static_cast<uint8_t>(step));
+            }
+            else
+            {
+                code.emit({ 0x48, 0x05 });                          // add rax, imm32
+                code.emit32(static_cast<uint32_t>(step));
+            }
+
+            if (step > 0)
+            {
+                code.emit({ 0x4C, 0x39, 0xF0 });                    // cmp rax, r14
+                code.emit({ 0x0F, 0x83 });                          // jae slow
+            }
+            else
+            {
+                code.emit({ 0x4C, 0x39, 0xE8 });                    // cmp rax, r13
+                code.emit({ 0x0F, 0x82 });                          // jb slow
+            }
+
+            slow.push_back(code.size());
+            code.emit32(0);
+
+            code.emit({ 0x80, 0x38, 0x00 });                        // cmp byte [rax], 0
+
+            if (loopInline)
+            {
+                code.emit({ 0x0F, 0x85 });                          // jnz loop
+                code.emit32(0);
+                code.patchRel32(code.size() - 4, loopStart);
+
+                code.emit8(0xE9);                                   // jmp found
+                found.push_back(code.size());
+                code.emit32(0);
+            }
+            else
+            {
+                code.emit({ 0x0F, 0x84 });                          // jz found
+                found.push_back(code.size());
+                code.emit32(0);
+            }
+        }
+
+        // Slow path: scan again from the original memory pointer so that a failed scan reports where it started.
+        for (auto field : slow)
+        {
+            code.patchRel32(field, code.size());
+        }
+
+        EmitCall(code, reinterpret_cast<const void*>(callback), index);
+        code.emit({ 0x48, 0x85, 0xC0 });                            // test rax, rax
+        code.emit({ 0x0F, 0x84 });                                  // jz abort
+        aborts.push_back(code.size());
+        code.emit32(0);
+
+        for (auto field : found)
+        {
+            code.patchRel32(field, code.size());
+        }
+
+        code.emit({ 0x48, 0x89, 0xC3 });                            // mov rbx, rax
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+NativeCode::NativeCode(const uint8_t* code, std::size_t size)
+    : size_(size)
+{
+#if BF_JIT_X64
+    // Map writable memory, copy the code in and then flip it to executable so the pages are never writable and
+    // executable at the same time.
+    auto pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    mappedSize_ = ((size + pageSize - 1) / pageSize) * pageSize;
+
+    memory_ = mmap(nullptr, mappedSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (memory_ == MAP_FAILED)
+    {
+        memory_ = nullptr;
+        throw std::runtime_error("Failed to allocate memory for native code");
+    }
+
+    std::memcpy(memory_, code, size);
+
+    if (mprotect(memory_, mappedSize_, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory_, mappedSize_);
+        memory_ = nullptr;
+        throw std::runtime_error("Failed to make native code executable");
+    }
+#else
+    (void)code;
+    throw std::runtime_error("Native code is not supported on this platform");
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+NativeCode::~NativeCode()
+{
+#if BF_JIT_X64
+    if (memory_ != nullptr)
+    {
+        munmap(memory_, mappedSize_);
+    }
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+entry_point_t NativeCode::entryPoint() const noexcept
+{
+    return reinterpret_cast<entry_point_t>(memory_);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool Brainfreeze::Jit::IsSupported() noexcept
+{
+    return BF_JIT_X64 != 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::unique_ptr<NativeCode> Brainfreeze::Jit::Compile(
+    const instruction_t* begin,
+    const instruction_t* end,
+    uint32_t firstIndex,
+    const runtime_callbacks_t& callbacks)
+{
+    if (!IsSupported())
+    {
+        return nullptr;
+    }
+
+    assert(callbacks.write != nullptr);
+    assert(callbacks.read != nullptr);
+    assert(callbacks.scanRight != nullptr);
+    assert(callbacks.scanLeft != nullptr);
+    assert(callbacks.moveOutOfBounds != nullptr);
+
+    CodeBuffer code;
+    std::vector<std::size_t> exits;         // rel32 fields that jump to the normal exit.
+    std::vector<std::size_t> aborts;        // rel32 fields that jump to the abort exit.
+
+    // The rel32 field of each pointer move's jump to its out of bounds stub, along with the move's index.
+    std::vector<std::pair<std::size_t, uint32_t>> outOfBounds;
+
+    // Each entry is the rel32 field of an open [ or IfZeroSkip along with the code offset just after it.
+    std::vector<std::pair<std::size_t, std::size_t>> loops;
+
+    // The rel32 field of the jump that skips the current run of MulAdd instructions.
+    std::size_t mulAddSkip = 0;
+
+    // Prologue: save callee saved registers and move the arguments into their assigned registers.
+    code.emit8(0x53);                                               // push rbx
+    code.emit({ 0x41, 0x54 });                                      // push r12
+    code.emit({ 0x41, 0x55 });                                      // push r13
+    code.emit({ 0x41, 0x56 });                                      // push r14
+    code.emit8(0x55);                                               // push rbp
+    code.emit({ 0x48, 0x89, 0xFB });                                // mov rbx, rdi
+    code.emit({ 0x49, 0x89, 0xF4 });                                // mov r12, rsi
+    code.emit({ 0x49, 0x89, 0xD5 });                                // mov r13, rdx
+    code.emit({ 0x49, 0x89, 0xCE });                                // mov r14, rcx
+
+    for (auto ip = begin; ip != end; ++ip)
+    {
+        auto index = static_cast<uint32_t>(firstIndex + (ip - begin));
+
+        switch (ip->opcode())
+        {
+        case OpcodeType::NoOperation:
+            break;
+
+        case OpcodeType::PtrInc:
+            EmitMovePointer(code, ip->param(), index, outOfBounds);
+            break;
+
+        case OpcodeType::PtrDec:
+            EmitMovePointer(code, -static_cast<int32_t>(ip->param()), index, outOfBounds);
+            break;
+
+        case OpcodeType::MemInc:
+            code.emit({ 0x80, 0x43 });                              // add byte [rbx + disp8], imm8
+            code.emit8(static_cast<uint8_t>(ip->offset()));
+            code.emit8(static_cast<uint8_t>(ip->param()));
+            break;
+
+        case OpcodeType::MemDec:
+            code.emit({ 0x80, 0x6B });                              // sub byte [rbx + disp8], imm8
+            code.emit8(static_cast<uint8_t>(ip->offset()));
+            code.emit8(static_cast<uint8_t>(ip->param()));
+            break;
+
+        case OpcodeType::SetZero:
+        case OpcodeType::SetValue:
+            code.emit({ 0xC6, 0x43 });                              // mov byte [rbx + disp8], imm8
+            code.emit8(static_cast<uint8_t>(ip->offset()));
+            code.emit8(static_cast<uint8_t>(ip->param()));
+            break;
+
+        case OpcodeType::MulAdd:
+            // A run of MulAdd instructions comes from a single multiply loop, which must not touch its target cells
+            // when the loop cell is zero. Guard the whole run with one test rather than testing for each target.
+            if (ip == begin || !(ip - 1)->isA(OpcodeType::MulAdd))
+            {
+                code.emit({ 0x80, 0x3B, 0x00 });                    // cmp byte [rbx], 0
+                code.emit({ 0x0F, 0x84 });                          // jz rel32
+                mulAddSkip = code.size();
+                code.emit32(0);
+            }
+
+            code.emit({ 0x0F, 0xBE, 0x03 });                        // movsx eax, byte [rbx]
+            code.emit({ 0x69, 0xC0 });                              // imul eax, eax, imm32
+            code.emit32(static_cast<uint32_t>(static_cast<int32_t>(ip->param())));
+            code.emit({ 0x00, 0x43 });                              // add byte [rbx + disp8], al
+            code.emit8(static_cast<uint8_t>(ip->offset()));
+
+            if (ip + 1 == end || !(ip + 1)->isA(OpcodeType::MulAdd))
+            {
+                code.patchRel32(mulAddSkip, code.size());
+            }
+            break;
+
+        case OpcodeType::ProductAdd:
+        {
+            // Like MulAdd, the cells are only touched when the loop cell is non-zero. The no-op word that follows
+            // holds the second factor's offset and emits nothing.
+            code.emit({ 0x80, 0x3B, 0x00 });                        // cmp byte [rbx], 0
+            code.emit({ 0x0F, 0x84 });                              // jz rel32
+            auto skip = code.size();
+            code.emit32(0);
+
+            code.emit({ 0x0F, 0xBE, 0x03 });                        // movsx eax, byte [rbx]
+            code.emit({ 0x0F, 0xBE, 0x4B });                        // movsx ecx, byte [rbx + disp8]
+            code.emit8(static_cast<uint8_t>((ip + 1)->offset()));
+            code.emit({ 0x0F, 0xAF, 0xC1 });                        // imul eax, ecx
+            code.emit({ 0x69, 0xC0 });                              // imul eax, eax, imm32
+            code.emit32(static_cast<uint32_t>(static_cast<int32_t>(ip->param())));
+            code.emit({ 0x00, 0x43 });                              // add byte [rbx + disp8], al
+            code.emit8(static_cast<uint8_t>(ip->offset()));
+            code.patchRel32(skip, code.size());
+            break;
+        }
+
+        case OpcodeType::CheckRange:
+            EmitCheckRange(code, ip->offset(), ip->param(), index, outOfBounds);
+            break;
+
+        case OpcodeType::CheckRangeIfNonZero:
+        {
+            // Checks the cells of a run of multiply loop instructions, which are only touched when the current cell
+            // is non-zero.
+            code.emit({ 0x80, 0x3B, 0x00 });                        // cmp byte [rbx], 0
+            code.emit({ 0x0F, 0x84 });                              // jz rel32
+            auto skip = code.size();
+            code.emit32(0);
+
+            EmitCheckRange(code, ip->offset(), ip->param(), index, outOfBounds);
+            code.patchRel32(skip, code.size());
+            break;
+        }
+
+        case OpcodeType::ScanRight:
+            EmitScan(code, callbacks.scanRight, ip->param(), index, aborts);
+            break;
+
+        case OpcodeType::ScanLeft:
+            EmitScan(code, callbacks.scanLeft, -static_cast<int32_t>(ip->param()), index, aborts);
+            break;
+
+        case OpcodeType::Write:
+            // The write callback writes the whole run of consecutive writes starting at its instruction.
+            if (ip == begin || !(ip - 1)->isA(OpcodeType::Write))
+            {
+                EmitCallback(code, callbacks.write, index, aborts);
+            }
+            break;
+
+        case OpcodeType::Read:
+            EmitCallback(code, callbacks.read, index, aborts);
+            break;
+
+        case OpcodeType::PrintString:
+            // The text is written by the write callback. The data words that follow are no-ops.
+            EmitCallback(code, callbacks.write, index, aborts);
+            break;
+
+        case OpcodeType::JumpForward:
+        case OpcodeType::FastJumpForward:
+        case OpcodeType::FarJumpForward:
+            // Skip past the matching ] when the current cell is zero. The target is patched when the ] is emitted.
+            code.emit({ 0x80, 0x3B, 0x00 });                        // cmp byte [rbx], 0
+            code.emit({ 0x0F, 0x84 });                              // jz rel32
+            loops.emplace_back(code.size(), code.size() + 4);
+            code.emit32(0);
+
+            // Jumps are matched by nesting so the distance in a far jump's extension word is not needed.
+            if (ip->isA(OpcodeType::FarJumpForward))
+            {
+                ++ip;
+            }
+            break;
+
+        case OpcodeType::JumpBack:
+        case OpcodeType::FastJumpBack:
+        case OpcodeType::FarJumpBack:
+        {
+            // Loop back to just after the matching [ when the current cell is non-zero.
+            if (loops.empty())
+            {
+                throw std::runtime_error("Unbalanced jump in native code compilation");
+            }
+
+            auto [forwardField, bodyStart] = loops.back();
+            loops.pop_back();
+
+            code.emit({ 0x80, 0x3B, 0x00 });                        // cmp byte [rbx], 0
+            code.emit({ 0x0F, 0x85 });                              // jnz rel32
+            code.emit32(0);
+            code.patchRel32(code.size() - 4, bodyStart);
+            code.patchRel32(forwardField, code.size());
+
+            if (ip->isA(OpcodeType::FarJumpBack))
+            {
+                ++ip;
+            }
+            break;
+        }
+
+        case OpcodeType::IfZeroSkip:
+        case OpcodeType::FarIfZeroSkip:
+            // Skip past the matching EndIf when the tested cell is zero. The target is patched by the EndIf.
+            code.emit({ 0x80, 0x7B });                              // cmp byte [rbx + disp8], 0
+            code.emit8(static_cast<uint8_t>(ip->offset()));
+            code.emit8(0x00);
+            code.emit({ 0x0F, 0x84 });                              // jz rel32
+            loops.emplace_back(code.size(), code.size() + 4);
+            code.emit32(0);
+
+            if (ip->isA(OpcodeType::FarIfZeroSkip))
+            {
+                ++ip;
+            }
+            break;
+
+        case OpcodeType::EndIf:
+        {
+            // The body always leaves its cell zero so there is no jump back, only the skip to patch.
+            if (loops.empty())
+            {
+                throw std::runtime_error("Unbalanced jump in native code compilation");
+            }
+
+            code.patchRel32(loops.back().first, code.size());
+            loops.pop_back();
+            break;
+        }
+
+        case OpcodeType::EndOfStream:
+            code.emit8(0xE9);                                       // jmp exit
+            exits.push_back(code.size());
+            code.emit32(0);
+            break;
+
+        default:
+            throw std::runtime_error("unknown instruction opcode");
+        }
+    }
+
+    if (!loops.empty())
+    {
+        throw std::runtime_error("Unbalanced jump in native code compilation");
+    }
+
+    // Normal exit: return the memory pointer.
+    for (auto field : exits)
+    {
+        code.patchRel32(field, code.size());
+    }
+
+    code.emit({ 0x48, 0x89, 0xD8 });                                // mov rax, rbx
+    code.emit8(0x5D);                                               // pop rbp
+    code.emit({ 0x41, 0x5E });                                      // pop r14
+    code.emit({ 0x41, 0x5D });                                      // pop r13
+    code.emit({ 0x41, 0x5C });                                      // pop r12
+    code.emit8(0x5B);                                               // pop rbx
+    code.emit8(0xC3);                                               // ret
+
+    // Out of bounds stubs: report the move or range check with the memory pointer from before it, which always
+    // aborts.
+    for (auto [field, index] : outOfBounds)
+    {
+        code.patchRel32(field, code.size());
+        EmitCallback(code, callbacks.moveOutOfBounds, index, aborts);
+    }
+
+    // Abort exit: a runtime callback failed so return null.
+    for (auto field : aborts)
+    {
+        code.patchRel32(field, code.size());
+    }
+
+    code.emit({ 0x31, 0xC0 });                                      // xor eax, eax
+    code.emit8(0x5D);                                               // pop rbp
+    code.emit({ 0x41, 0x5E });                                      // pop r14
+    code.emit({ 0x41, 0x5D });                                      // pop r13
+    code.emit({ 0x41, 0x5C });                                      // pop r12
+    code.emit8(0x5B);                                               // pop rbx
+    code.emit8(0xC3);                                               // ret
+
+    try
+    {
+        return std::make_unique<NativeCode>(code.data(), code.size());
+    }
+    catch (const std::runtime_error&)
+    {
+        return nullptr;
+    }
+}
@@ -0,0 +1,63 @@
+// Copyright 2009-2020, Scott MacDonald.
+#pragma once
+#include "bf/bf.h"
+#include "jit.h"
+
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <vector>
+
+namespace Brainfreeze
+{
+    /**
+     * State shared between the interpreter and native code generated by the JIT. This holds the runtime callbacks
+     * native code uses for console I/O, and for tiered execution the back edge counters and compiled loops.
+     */
+    struct Interpreter::native_runtime_t
+    {
+        /** Constructor. */
+        explicit native_runtime_t(Interpreter& interpreter);
+
+        /** Run native code from the given memory pointer and return the memory pointer afterwards. */
+        byte_t* run(Jit::entry_point_t entry, byte_t* mp);
+
+        /**
+         * Compile the loop starting at the given [ instruction and record its entry point. If compilation fails the
+         * loop keeps being interpreted.
+         */
+        void compileLoop(std::size_t headIndex);
+
+        /**
+         * Runtime callback for console writes, which writes the run of consecutive writes starting at the index or the
+         * text of a PrintString.
+         */
+        static int write(void* context, int8_t* mp, uint32_t index);
+
+        /** Runtime callback for console reads, specialised for the end of stream behavior. */
+        template<EndOfStreamBehavior EndOfStream>
+        static int read(void* context, int8_t* mp, uint32_t index);
+
+        /** Scan callback for ScanRight instructions. */
+        static int8_t* scanRight(void* context, int8_t* mp, uint32_t index);
+
+        /** Scan callback for ScanLeft instructions. */
+        static int8_t* scanLeft(void* context, int8_t* mp, uint32_t index);
+
+        /**
+         * Runtime callback for pointer moves and range checks that would leave memory, which always aborts native
+         * execution.
+         */
+        static int moveOutOfBounds(void* context, int8_t* mp, uint32_t index);
+
+        Interpreter& self;
+        Jit::runtime_callbacks_t callbacks;
+        std::exception_ptr error;
+
+        std::unique_ptr<Jit::NativeCode> programCode;
+        std::vector<std::unique_ptr<Jit::NativeCode>> loopCode;
+
+        std::vector<uint64_t> backEdgeCounts;           ///< Times each loop has jumped back, indexed by its [.
+        std::vector<Jit::entry_point_t> loopEntries;    ///< Compiled loop entry points, indexed by the loop's [.
+    };
+}
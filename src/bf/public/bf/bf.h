@@ -3,6 +3,7 @@
 
 #include "instruction.h"
 #include "compiler.h"
+#include "program.h"
 #include "iconsole.h"
 
 #include <cstdint>
@@ -15,13 +16,14 @@ namespace Brainfreeze
 {
     constexpr const char* Version = "0.2";
 
+    class Tape;
+
     /** The brainfreeze interpreter. */
     class Interpreter
     {
     public:
         using byte_t = int8_t;
         using instruction_list_t = std::vector<instruction_t>;
-        using memory_buffer_t = std::vector<byte_t>;
 
         /** Opaque instruction pointer type. */
         struct instruction_pointer_t
@@ -51,9 +53,10 @@ namespace Brainfreeze
         struct memory_pointer_t
         {
             explicit memory_pointer_t(
-                    memory_buffer_t::const_iterator begin,
-                    memory_buffer_t::const_iterator current)
-                : begin_(begin), current_(current)
+                    const byte_t* begin,
+                    const byte_t* current,
+                    std::size_t cellSize = 1)
+                : begin_(begin), current_(current), cellSize_(cellSize)
             {
             }
 
@@ -62,18 +65,21 @@ namespace Brainfreeze
                 return begin_ == other.begin_ && current_ == other.current_;
             }
 
+            /** Get the address of the cell pointed at, counted in cells rather than bytes. */
             std::size_t address() const
             {
-                return current_ - begin_;
+                return (current_ - begin_) / cellSize_;
             }
 
+            /** Get the first byte of the cell pointed at. */
             byte_t data() const
             {
                 return *current_;
             }
 
-            memory_buffer_t::const_iterator begin_;
-            memory_buffer_t::const_iterator current_;
+            const byte_t* begin_;
+            const byte_t* current_;
+            std::size_t cellSize_;
         };
 
         enum class RunState
@@ -91,6 +97,23 @@ namespace Brainfreeze
             Ignore = 3
         };
 
+        /** Selects how memory for the cells is allocated. */
+        enum class TapeMode
+        {
+            Fixed = 0,              ///< Allocate the cell count up front, starting at cell zero.
+            Growing = 1,            ///< Commit memory on both sides of cell zero as it is touched, up to a limit.
+            Sparse = 2              ///< Commit each page of the cell count as it is touched, up to a limit.
+        };
+
+        /** Selects the execution strategy used when running a program. */
+        enum class ExecutionEngine
+        {
+            Basic = 0,              ///< Decode and dispatch one instruction at a time with a switch.
+            Threaded = 1,           ///< Direct threaded dispatch over a pre-translated handler table.
+            Jit = 2,                ///< Compile to native code, or use the threaded engine when unsupported.
+            Tiered = 3              ///< Interpret, and compile loops to native code once they become hot.
+        };
+
     public:
         /** Construct interpreter with code to be run. */
         Interpreter(std::vector<instruction_t> instructions);
@@ -100,6 +123,20 @@ namespace Brainfreeze
             std::vector<instruction_t> instructions,
             std::unique_ptr<IConsole> console);
 
+        /**
+         * Construct interpreter with a compiled program to be run, which can be shared with other interpreters. The
+         * cell size and cell count start out as the ones the program was compiled for.
+         */
+        Interpreter(std::shared_ptr<const Program> program);
+
+        /**
+         * Construct interpreter with a compiled program to be run, which can be shared with other interpreters. The
+         * cell size and cell count start out as the ones the program was compiled for.
+         */
+        Interpreter(
+            std::shared_ptr<const Program> program,
+            std::unique_ptr<IConsole> console);
+
         /** Destructor. */
         ~Interpreter();
 
@@ -107,21 +144,59 @@ namespace Brainfreeze
         /** Get the number of memory cells to allocate for execution. */
         std::size_t cellCount() const noexcept { return cellCount_; }
 
-        /** Set the number of memory cells to allocate for execution. */
+        /**
+         * Set the number of memory cells to allocate for execution. Programs can be partially evaluated at compile time
+         * on the number of cells they were compiled for, so they should not be run with fewer.
+         */
         void setCellCount(size_t count);
 
         /** Get the size in bytes for a memory cell. */
         std::size_t cellSize() const noexcept { return cellSize_; }
 
-        /** Set the size in bytes for a memory cell. */
+        /**
+         * Set the size in bytes for a memory cell, which must be 1, 2, 4 or 8. The program should be compiled for the
+         * same cell size since some compiler passes assume cells wrap around at 8 bits.
+         */
         void setCellSize(size_t bytes);
 
+        /** Get how memory for the cells is allocated. */
+        TapeMode tapeMode() const noexcept { return tapeMode_; }
+
+        /**
+         * Set how memory for the cells is allocated. Growing tapes ignore the cell count, and cells to the left of
+         * cell zero can be used but not inspected with memoryAt() or cellAt().
+         */
+        void setTapeMode(TapeMode mode);
+
+        /** Get the most bytes of memory a growing or sparse tape can use. */
+        std::size_t maxMemory() const noexcept { return maxMemory_; }
+
+        /**
+         * Set the most bytes of memory a growing or sparse tape can use before the program is stopped with an error.
+         */
+        void setMaxMemory(std::size_t bytes);
+
         /** Get the end of stream behavior. */
         EndOfStreamBehavior endOfStreamBehavior() const noexcept { return endOfStreamBehavior_; }
 
         /** Set the end of stream behavior. */
         void setEndOfStreamBehavior(EndOfStreamBehavior behavior) noexcept { endOfStreamBehavior_ = behavior; }
 
+        /** Get the execution engine used to run the program. */
+        ExecutionEngine executionEngine() const noexcept { return executionEngine_; }
+
+        /** Set the execution engine used to run the program. */
+        void setExecutionEngine(ExecutionEngine engine);
+
+        /** Get how many times a loop must jump back before the tiered engine compiles it to native code. */
+        std::size_t tierUpThreshold() const noexcept { return tierUpThreshold_; }
+
+        /** Set how many times a loop must jump back before the tiered engine compiles it to native code. */
+        void setTierUpThreshold(std::size_t count);
+
+        /** Get the program run by the interpreter. */
+        const std::shared_ptr<const Program>& program() const noexcept { return program_; }
+
         /** Get the console used by the interpreter. */
         IConsole* console() const { return console_.get(); }
 
@@ -136,10 +211,13 @@ namespace Brainfreeze
          * Get the value stored at the requested memory address.
          *
          * \param   The memory offset to fetch
-         * \returns The value that was stored in that memory block
+         * \returns The value that was stored in that memory block, or its lowest byte when cells are wider
          */
         byte_t memoryAt(std::size_t address) const;
 
+        /** Get the value of the cell at the requested address, which can be wider than a byte. */
+        int64_t cellAt(std::size_t address) const;
+
         /** Get the current instruction pointer. */
         instruction_pointer_t instructionPointer() const;
 
@@ -153,19 +231,89 @@ namespace Brainfreeze
         /** Execute the next instruction and return the running state after executing the one step. */
         RunState runStep();
 
+        /** Execute the program to completion with the basic engine. */
+        void runBasic();
+
+        /**
+         * Execute instructions with the basic engine until the program finishes, or until one instruction has been
+         * executed when SingleStep is true. Returns the running state afterwards.
+         *
+         * Memory is accessed as an array of Cell, and reads at the end of input follow the EndOfStream behavior. When
+         * Tiered is true back jumps are counted, and hot loops are compiled and run as native code. Native code only
+         * supports one byte cells.
+         */
+        template<typename Cell, EndOfStreamBehavior EndOfStream, bool SingleStep, bool Tiered>
+        RunState execute();
+
+        /** Execute the program to completion with the direct threaded engine. */
+        void runThreaded();
+
+        /** Execute the program to completion with the direct threaded engine specialised for the cell type. */
+        template<typename Cell, EndOfStreamBehavior EndOfStream>
+        void executeThreaded();
+
+        /** Execute the program to completion by compiling it to native code. */
+        void runJit();
+
+        /** Execute the program to completion by interpreting it and compiling hot loops to native code. */
+        void runTiered();
+
+        /** Read a byte from the console into a cell and apply the end of stream behavior to it. */
+        template<typename Cell, EndOfStreamBehavior EndOfStream>
+        Cell readCell(Cell current);
+
+        /**
+         * Write the cells named by the run of consecutive Write instructions starting at `index` to the console as
+         * one block. Returns the number of instructions in the run.
+         */
+        template<typename Cell>
+        std::size_t writeRun(const Cell* mp, std::size_t index);
+
+        /**
+         * Throw if a cell that console I/O touches is outside of memory. Console I/O checks its own cell rather than
+         * relying on the compiler's range checks, so that every write before one that fails is still printed.
+         */
+        void checkConsoleCell(const void* cell) const;
+
+        /**
+         * Check a cell that input is about to be read into, and commit it if the tape has not yet. Throws if the cell
+         * is outside of memory or committing it would exceed the memory limit. Console I/O never touches memory the
+         * tape has not committed, so it cannot fault while the console is on the stack.
+         */
+        void commitConsoleCell(void* cell);
+
+        /**
+         * Write the text of the PrintString instruction at `index` to the console. Returns the number of instructions
+         * the PrintString takes up including its data words.
+         */
+        std::size_t printString(std::size_t index);
+
+    private:
+        /** State shared with native code generated by the JIT. */
+        struct native_runtime_t;
+
+        /** Program translated for the threaded engine. */
+        struct threaded_program_t;
+
     private:
-        instruction_list_t instructions_;
-        memory_buffer_t memory_;
+        std::shared_ptr<const Program> program_;
+        std::unique_ptr<Tape> memory_;
 
         instruction_list_t::const_iterator ip_;
-        memory_buffer_t::iterator mp_;
+        byte_t* mp_ = nullptr;
 
         RunState state_ = RunState::NotStarted;
 
         std::size_t cellCount_ = 30000;
         std::size_t cellSize_ = 1;
+        TapeMode tapeMode_ = TapeMode::Fixed;
+        std::size_t maxMemory_ = 1024 * 1024 * 1024;
         EndOfStreamBehavior endOfStreamBehavior_ = EndOfStreamBehavior::NegativeOne;
+        ExecutionEngine executionEngine_ = ExecutionEngine::Basic;
+        std::size_t tierUpThreshold_ = 1000;
 
         std::unique_ptr<IConsole> console_;
+        std::unique_ptr<native_runtime_t> nativeRuntime_;
+        std::unique_ptr<threaded_program_t> threadedProgram_;
     };
 }
@@ -1,38 +1,301 @@
 // Copyright 2009-2020, Scott MacDonald.
 #pragma once
 #include "instruction.h"
+#include "program.h"
 
-#include <vector>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace Brainfreeze
 {
+    /** Passes the compiler can run over a parsed program, listed in the order they run. */
+    enum class CompilerPass
+    {
+        MergeRuns = 0,
+        CancelRuns = 1,
+        DeadLoops = 2,
+        ClearLoops = 3,
+        MultiplyLoops = 4,
+        ClosedFormLoops = 5,
+        ScanLoops = 6,
+        IfLoops = 7,
+        OffsetAddressing = 8,
+        ConstantPropagation = 9,
+        PartialEvaluation = 10,
+        FoldConstantOutput = 11,
+        LinkJumps = 12
+    };
+
+    constexpr const size_t CompilerPassCount = static_cast<size_t>(CompilerPass::LinkJumps) + 1;
+
     /** Compiles Brainfreeze code into executable instructions. */
     class Compiler
     {
     public:
-        /** Convert Brainfreeze code into an executable Brainfreeze program. */
+        /** Lowest optimization level, which runs no passes. */
+        static constexpr int MinOptimizationLevel = 0;
+
+        /** Highest optimization level, which runs every pass. */
+        static constexpr int MaxOptimizationLevel = 3;
+
+        /** Optimization level used unless another one is chosen. */
+        static constexpr int DefaultOptimizationLevel = 2;
+
+    public:
+        /** Constructor, which enables the passes for the default optimization level. */
+        Compiler();
+
+        /**
+         * Convert Brainfreeze code into an executable Brainfreeze program. The code is parsed into one instruction
+         * per command, and then each enabled pass is run over the instructions in order.
+         */
         std::vector<instruction_t> compile(std::string_view programtext) const;
 
+        /**
+         * Convert Brainfreeze code into a program that any number of interpreters can share, including interpreters
+         * running on different threads. The program remembers the cell size and cell count it was compiled for.
+         */
+        std::shared_ptr<const Program> compileProgram(std::string_view programtext) const;
+
     public:
+        /**
+         * Enable every pass that runs at the given optimization level and disable the rest. Passes can still be
+         * enabled or disabled individually afterwards. An exception is thrown if the level is out of range.
+         */
+        void setOptimizationLevel(int level);
+
+        /** Get if the given pass is run when compiling. */
+        bool isPassEnabled(CompilerPass pass) const noexcept { return enabledPasses_[static_cast<size_t>(pass)]; }
+
+        /** Set if the given pass is run when compiling. */
+        void setPassEnabled(CompilerPass pass, bool isEnabled) noexcept
+        {
+            enabledPasses_[static_cast<size_t>(pass)] = isEnabled;
+        }
+
+        /** Get the name of a pass as used on the command line, like "clear-loops". */
+        static std::string_view passName(CompilerPass pass);
+
+        /** Get the description of a pass. */
+        static std::string_view passDescription(CompilerPass pass);
+
+        /** Get the lowest optimization level that enables a pass. */
+        static int passOptimizationLevel(CompilerPass pass);
+
+        /**
+         * Get if a pass assumes cells wrap around at 8 bits, such as by computing cell values at compile time. These
+         * passes are skipped when compiling for wider cells.
+         */
+        static bool passNeedsByteCells(CompilerPass pass) noexcept;
+
+        /** Find a pass by its name, or return nothing if no pass has the name. */
+        static std::optional<CompilerPass> findPass(std::string_view name);
+
         /** Get if the compiler can merge a sequence of identical instructions together. */
-        bool isMergeInstructionsEnabled() const noexcept { return mergeInstructions_; }
+        bool isMergeInstructionsEnabled() const noexcept { return isPassEnabled(CompilerPass::MergeRuns); }
 
-        /** Set if the compiler can merge a sequence of identical instructions together. */
-        void setMergeInstructionsEnabled(bool isEnabled) noexcept { mergeInstructions_ = isEnabled; }
+        /**
+         * Set if the compiler can merge a sequence of identical instructions together. This also controls cancelling
+         * out runs of opposing instructions like +- since that is a form of merging.
+         */
+        void setMergeInstructionsEnabled(bool isEnabled) noexcept
+        {
+            setPassEnabled(CompilerPass::MergeRuns, isEnabled);
+            setPassEnabled(CompilerPass::CancelRuns, isEnabled);
+        }
 
         /** Get if the compiler can precalculate the distance to the corresponding jump target. */
-        bool isPrecalculateJumpOffsetsEnabled() const noexcept { return precalculateJumpOffsets_; }
+        bool isPrecalculateJumpOffsetsEnabled() const noexcept { return isPassEnabled(CompilerPass::LinkJumps); }
 
         /** Set if the compiler can precalculate the distance to the corresponding jump target. */
-        void setPrecalculateJumpOffsetsEnabled(bool isEnabled) noexcept { precalculateJumpOffsets_ = isEnabled; }
+        void setPrecalculateJumpOffsetsEnabled(bool isEnabled) noexcept
+        {
+            setPassEnabled(CompilerPass::LinkJumps, isEnabled);
+        }
+
+        /** Get if the compiler can replace clear loops ([-] and [+]) with an instruction that sets the cell value. */
+        bool isReplaceClearLoopsEnabled() const noexcept { return isPassEnabled(CompilerPass::ClearLoops); }
+
+        /** Set if the compiler can replace clear loops ([-] and [+]) with an instruction that sets the cell value. */
+        void setReplaceClearLoopsEnabled(bool isEnabled) noexcept
+        {
+            setPassEnabled(CompilerPass::ClearLoops, isEnabled);
+        }
+
+        /** Get if the compiler can replace multiply loops (like [->++<]) with multiply and add instructions. */
+        bool isReplaceMultiplyLoopsEnabled() const noexcept { return isPassEnabled(CompilerPass::MultiplyLoops); }
+
+        /**
+         * Set if the compiler can replace multiply loops (like [->++<]) with multiply and add instructions. This also
+         * controls replacing loops of multiply loops with closed form arithmetic.
+         */
+        void setReplaceMultiplyLoopsEnabled(bool isEnabled) noexcept
+        {
+            setPassEnabled(CompilerPass::MultiplyLoops, isEnabled);
+            setPassEnabled(CompilerPass::ClosedFormLoops, isEnabled);
+        }
+
+        /** Get if the compiler can replace scan loops (like [>] and [<<]) with scan instructions. */
+        bool isReplaceScanLoopsEnabled() const noexcept { return isPassEnabled(CompilerPass::ScanLoops); }
+
+        /** Set if the compiler can replace scan loops (like [>] and [<<]) with scan instructions. */
+        void setReplaceScanLoopsEnabled(bool isEnabled) noexcept
+        {
+            setPassEnabled(CompilerPass::ScanLoops, isEnabled);
+        }
+
+        /**
+         * Get if the compiler can address cells with an offset from the memory pointer instead of moving the memory
+         * pointer back and forth within a block of instructions.
+         */
+        bool isOffsetAddressingEnabled() const noexcept { return isPassEnabled(CompilerPass::OffsetAddressing); }
+
+        /**
+         * Set if the compiler can address cells with an offset from the memory pointer instead of moving the memory
+         * pointer back and forth within a block of instructions.
+         */
+        void setOffsetAddressingEnabled(bool isEnabled) noexcept
+        {
+            setPassEnabled(CompilerPass::OffsetAddressing, isEnabled);
+        }
+
+        /**
+         * Get if the compiler can run the start of the program, up to the first read, and replace it with the memory
+         * and output it produced.
+         */
+        bool isPartialEvaluationEnabled() const noexcept { return isPassEnabled(CompilerPass::PartialEvaluation); }
+
+        /**
+         * Set if the compiler can run the start of the program, up to the first read, and replace it with the memory
+         * and output it produced.
+         */
+        void setPartialEvaluationEnabled(bool isEnabled) noexcept
+        {
+            setPassEnabled(CompilerPass::PartialEvaluation, isEnabled);
+        }
+
+        /** Get the most instructions the compiler will execute when partially evaluating a program. */
+        size_t partialEvaluationBudget() const noexcept { return partialEvaluationBudget_; }
+
+        /** Set the most instructions the compiler will execute when partially evaluating a program. */
+        void setPartialEvaluationBudget(size_t count) noexcept { partialEvaluationBudget_ = count; }
+
+        /** Get if the compiler can replace writes of cells with values known at compile time with PrintString. */
+        bool isFoldConstantOutputEnabled() const noexcept { return isPassEnabled(CompilerPass::FoldConstantOutput); }
+
+        /** Set if the compiler can replace writes of cells with values known at compile time with PrintString. */
+        void setFoldConstantOutputEnabled(bool isEnabled) noexcept
+        {
+            setPassEnabled(CompilerPass::FoldConstantOutput, isEnabled);
+        }
+
+        /** Get the size in bytes of the memory cells the program is compiled for. */
+        size_t cellSize() const noexcept { return cellSize_; }
+
+        /**
+         * Set the size in bytes of the memory cells the program is compiled for, which must be 1, 2, 4 or 8 and match
+         * the interpreter's cell size. An exception is thrown for any other size.
+         */
+        void setCellSize(size_t bytes);
+
+        /** Get the number of memory cells the program is compiled for. */
+        size_t cellCount() const noexcept { return cellCount_; }
+
+        /**
+         * Set the number of memory cells the program is compiled for, which should match the interpreter's cell count.
+         * Partial evaluation runs the start of the program on a tape of this many cells, so the program must not be
+         * run with fewer. An exception is thrown if the count is zero.
+         */
+        void setCellCount(size_t count);
 
     public:
         /** Get if an instruction can be merged together for optimization. TODO: move this. */
         static bool isMergable(const instruction_t& instr) noexcept;
 
     private:
-        bool mergeInstructions_ = true;
-        bool precalculateJumpOffsets_ = true;
+        /** Convert program text into one instruction per command, validating jumps but not linking them. */
+        std::vector<instruction_t> parse(std::string_view programtext) const;
+
+        /** Run a single pass over the instructions. */
+        void runPass(CompilerPass pass, std::vector<instruction_t>& instructions) const;
+
+        /** Merge runs of identical mergable instructions into one instruction, splitting runs too long to fit. */
+        void mergeRuns(std::vector<instruction_t>& instructions) const;
+
+        /**
+         * Replace each run of mixed MemInc and MemDec, or of mixed PtrInc and PtrDec, with the net change. Cell changes
+         * wrap around like the 8 bit cells they are applied to when compiling for one byte cells, and runs with no net
+         * change are removed.
+         */
+        void cancelRuns(std::vector<instruction_t>& instructions) const;
+
+        /**
+         * Remove loops that can never run because the current cell is known to be zero when they start, such as
+         * comment loops at the start of a program or a loop placed right after another loop.
+         */
+        void removeDeadLoops(std::vector<instruction_t>& instructions) const;
+
+        /** Replace clear loops with SetZero, or SetValue when the loop is followed by an adjustment. */
+        void replaceClearLoops(std::vector<instruction_t>& instructions) const;
+
+        /** Replace balanced loops that decrement or increment their cell by one with MulAdd and SetZero. */
+        void replaceMultiplyLoops(std::vector<instruction_t>& instructions) const;
+
+        /**
+         * Replace counted loops whose body became straight line code after replacing multiply loops, such as the
+         * outer loop of a[-b[-t+u+b]u[-b+u]a], with arithmetic that computes every iteration at once.
+         */
+        void replaceClosedFormLoops(std::vector<instruction_t>& instructions) const;
+
+        /** Replace loops that only move the pointer with ScanRight or ScanLeft. */
+        void replaceScanLoops(std::vector<instruction_t>& instructions) const;
+
+        /**
+         * Replace loops whose body always leaves the pointer where it started and the loop cell zero, such as
+         * [>+<[-]], with an IfZeroSkip and EndIf pair that runs the body at most once without testing it again.
+         */
+        void replaceIfLoops(std::vector<instruction_t>& instructions) const;
+
+        /** Replace pointer movement within basic blocks with offsets on the instructions that access memory. */
+        void applyOffsetAddressing(std::vector<instruction_t>& instructions) const;
+
+        /**
+         * Track the values of cells that are known at compile time, and use them to replace adds on known cells with
+         * stores, remove stores of the value a cell already has and decide loops and skips whose cell is known.
+         */
+        void propagateConstants(std::vector<instruction_t>& instructions) const;
+
+        /**
+         * Run the program until it reads input or runs out of budget, and replace the part that ran with instructions
+         * that recreate the memory and output it produced.
+         */
+        void partiallyEvaluate(std::vector<instruction_t>& instructions) const;
+
+        /**
+         * Track the values of cells that are known at compile time, and replace runs of writes that print known
+         * values with a PrintString holding the text.
+         */
+        void foldConstantOutput(std::vector<instruction_t>& instructions) const;
+
+        /**
+         * Start each block of straight line code that touches cells at an offset from the memory pointer with a
+         * CheckRange covering those cells. This always runs, after the passes that add offsets and before jumps are
+         * linked, since the execution engines only check pointer moves and console I/O themselves.
+         */
+        void checkOffsetRanges(std::vector<instruction_t>& instructions) const;
+
+        /** Convert jumps to fast jumps with the distance to the matching jump stored in each instruction. */
+        void linkJumps(std::vector<instruction_t>& instructions) const;
+
+    private:
+        std::array<bool, CompilerPassCount> enabledPasses_ = {};
+        size_t partialEvaluationBudget_ = 1000000;
+        size_t cellSize_ = 1;
+        size_t cellCount_ = 30000;
     };
 }
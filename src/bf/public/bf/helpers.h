@@ -8,7 +8,9 @@
 
 namespace Brainfreeze
 {
+    class Compiler;
     class Interpreter;
+    class Program;
 }
 
 namespace Brainfreeze::Helpers
@@ -23,6 +25,28 @@ namespace Brainfreeze::Helpers
      */
     std::unique_ptr<Interpreter> LoadFromDisk(const std::string& filepath);
 
+    /**
+     * Read a text file containing Brainfreeze code from disk, compile it with the given compiler and return an
+     * interpreter instance capable of executing the code. Throws an exception if something goes wrong while trying to
+     * load or compile the code.
+     *
+     * \param    filename Path to the file that will be read.
+     * \param    compiler Compiler configured with the passes to run.
+     * \returns  New interpreter that is ready to run the loaded code.
+     */
+    std::unique_ptr<Interpreter> LoadFromDisk(const std::string& filepath, const Compiler& compiler);
+
+    /**
+     * Read a text file containing Brainfreeze code from disk and compile it with the given compiler into a program
+     * that any number of interpreters can share. Throws an exception if something goes wrong while trying to load or
+     * compile the code.
+     *
+     * \param    filename Path to the file that will be read.
+     * \param    compiler Compiler configured with the passes to run.
+     * \returns  The compiled program.
+     */
+    std::shared_ptr<const Program> LoadProgramFromDisk(const std::string& filepath, const Compiler& compiler);
+
     /**
      * Find the location of the matching jump instruction for a given jump in the Brainfreeze program.
      * ex: Given a program "+[[-]]", FindJumpTarget(1) would return 5.
@@ -34,6 +58,12 @@ namespace Brainfreeze::Helpers
         std::vector<instruction_t>::const_iterator end,
         std::vector<instruction_t>::const_iterator jump);
 
+    /** Get if an unlinked instruction opens a block that FindJumpTarget can match, such as JumpForward. */
+    bool IsJumpStart(const instruction_t& instr) noexcept;
+
+    /** Get if an unlinked instruction closes a block that FindJumpTarget can match, such as JumpBack. */
+    bool IsJumpEnd(const instruction_t& instr) noexcept;
+
     /** Get if a character is a valid brainfreeze instruction. */
     bool IsInstruction(char c) noexcept;
 
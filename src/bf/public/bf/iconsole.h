@@ -1,6 +1,7 @@
 // Copyright 2009-2020, Scott MacDonald.
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 namespace Brainfreeze
@@ -39,6 +40,18 @@ namespace Brainfreeze
         /** Default read implementation: reads a byte from standard input. */
         virtual char read() = 0;
 
+        /**
+         * Write a block of bytes to standard output. The default implementation calls write once for each byte, and
+         * consoles that can write a block at once should override it.
+         */
+        virtual void writeBlock(const char* data, std::size_t size);
+
+        /**
+         * Read up to `size` bytes from standard input, stopping early only at the end of input. Returns the number of
+         * bytes read. The default implementation calls read once for each byte, and treats EOF as the end of input.
+         */
+        virtual std::size_t readBlock(char* buffer, std::size_t size);
+
         IConsole(const IConsole&) = delete;
         IConsole& operator =(const IConsole&) = delete;
 
@@ -1,6 +1,8 @@
 // Copyright 2009-2020, Scott MacDonald.
 #pragma once
+#include <cstddef>
 #include <cstdint>
+#include <utility>
 
 namespace Brainfreeze
 {
@@ -18,7 +20,22 @@ namespace Brainfreeze
         JumpForward = 9,
         JumpBack = 10,
         FastJumpForward = 11,
-        FastJumpBack = 12
+        FastJumpBack = 12,
+        SetZero = 13,
+        SetValue = 14,
+        MulAdd = 15,
+        ScanRight = 16,
+        ScanLeft = 17,
+        FarJumpForward = 18,
+        FarJumpBack = 19,
+        PrintString = 20,
+        IfZeroSkip = 21,
+        EndIf = 22,
+        ProductAdd = 23,
+        Extension = 24,
+        FarIfZeroSkip = 25,
+        CheckRange = 26,
+        CheckRangeIfNonZero = 27
     };
 
     /** Defines an executable Brainfreeze instruction. */
@@ -26,6 +43,7 @@ namespace Brainfreeze
     {
     public:
         using param_t = int16_t;
+        using offset_t = int8_t;
 
     public:
         /** Default constructor, defaults to a NOP instruction. */
@@ -37,6 +55,9 @@ namespace Brainfreeze
         /** Constructor that takes an opcode and optional parameter value. */
         instruction_t(OpcodeType op, param_t value) noexcept;
 
+        /** Constructor that takes an opcode, parameter value and a memory offset relative to the memory pointer. */
+        instruction_t(OpcodeType op, param_t value, offset_t offset) noexcept;
+
         /** Get the opcode encoded in this instruction. */
         OpcodeType opcode() const noexcept;
 
@@ -58,6 +79,64 @@ namespace Brainfreeze
          */
         void incrementParam(param_t amount);
 
+        /** Get the memory offset, relative to the memory pointer, that this instruction operates on. */
+        offset_t offset() const noexcept;
+
+        /** Set the memory offset, relative to the memory pointer, that this instruction operates on. */
+        void setOffset(offset_t offset) noexcept;
+
+        /** Largest value an extension word can hold. */
+        static constexpr uint32_t MaxExtensionValue = 0x00FFFFFF;
+
+        /** Largest distance a far jump can hold, which is far more instructions than a program can have. */
+        static constexpr uint64_t MaxFarDistance = (uint64_t{ 1 } << 40) - 1;
+
+        /**
+         * Create an extension word, which holds a value of up to 24 bits for the instruction before it when the value
+         * does not fit in that instruction's parameter. Extension words have the Extension opcode so anything that
+         * looks at opcodes, like a search for a matching jump, never mistakes one for an instruction. They are never
+         * executed.
+         */
+        static instruction_t extension(uint32_t value) noexcept;
+
+        /** Get the value held by an extension word. */
+        uint32_t extensionValue() const noexcept { return data_ >> 8; }
+
+        /**
+         * Create a far jump (FarJumpForward, FarJumpBack or FarIfZeroSkip) and the extension word that follows it. The
+         * low 24 bits of the distance are held by the extension word and the rest by the far jump's parameter.
+         */
+        static std::pair<instruction_t, instruction_t> farJump(OpcodeType op, uint64_t distance, offset_t offset = 0)
+            noexcept;
+
+        /** Get the distance held by a far jump, given the extension word that follows it. */
+        uint64_t farDistance(const instruction_t& extension) const noexcept
+        {
+            return (static_cast<uint64_t>(static_cast<uint16_t>(param())) << 24) | extension.extensionValue();
+        }
+
+        /** Number of text bytes held by each data word following a PrintString instruction. */
+        static constexpr std::size_t StringBytesPerWord = 3;
+
+        /** Get the number of data words needed to hold a PrintString instruction's text. */
+        static constexpr std::size_t stringDataWordCount(std::size_t length) noexcept
+        {
+            return (length + StringBytesPerWord - 1) / StringBytesPerWord;
+        }
+
+        /**
+         * Create a data word holding up to three bytes of text for the PrintString instruction before it. Data words
+         * have the NoOperation opcode so anything that walks the instructions without knowing about them, like a
+         * search for a matching jump, skips over them.
+         */
+        static instruction_t stringData(const char* text, std::size_t count) noexcept;
+
+        /** Get one of the text bytes held by a PrintString data word. */
+        char stringByte(std::size_t index) const noexcept
+        {
+            return static_cast<char>((data_ >> (8 * (index + 1))) & 0xFF);
+        }
+
         /** Equality comparison operator. */
         bool operator ==(const instruction_t& other) const noexcept;
 
@@ -65,6 +144,33 @@ namespace Brainfreeze
         bool operator !=(const instruction_t& other) const noexcept;
 
     private:
+        // Layout from the least significant bit: 8 bit opcode, 16 bit parameter and 8 bit memory offset.
         uint32_t data_ = 0;
     };
+
+    // The opcode and parameter accessors are defined inline because they are called for every executed instruction.
+
+    //-----------------------------------------------------------------------------------------------------------------
+    inline OpcodeType instruction_t::opcode() const noexcept
+    {
+        return static_cast<OpcodeType>(data_ & 0x000000FF);
+    }
+
+    //-----------------------------------------------------------------------------------------------------------------
+    inline instruction_t::param_t instruction_t::param() const noexcept
+    {
+        return static_cast<instruction_t::param_t>((data_ & 0x00FFFF00) >> 8);
+    }
+
+    //-----------------------------------------------------------------------------------------------------------------
+    inline instruction_t::offset_t instruction_t::offset() const noexcept
+    {
+        return static_cast<instruction_t::offset_t>((data_ & 0xFF000000) >> 24);
+    }
+
+    //-----------------------------------------------------------------------------------------------------------------
+    inline bool instruction_t::isA(OpcodeType op) const noexcept
+    {
+        return opcode() == op;
+    }
 }
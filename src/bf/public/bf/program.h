@@ -0,0 +1,54 @@
+// Copyright 2009-2020, Scott MacDonald.
+#pragma once
+#include "instruction.h"
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace Brainfreeze
+{
+    /**
+     * A compiled Brainfreeze program. Programs are immutable once created and are shared with std::shared_ptr, so any
+     * number of interpreters can run the same program at once, including from different threads, without copying or
+     * recompiling it.
+     *
+     * Everything the execution engines need is stored in the instructions: linked jumps hold the distance to their
+     * target, and the text of PrintString instructions is stored in the data words that follow them.
+     */
+    class Program
+    {
+    public:
+        /**
+         * Construct a program from compiled instructions, which were compiled for `cellCount` cells of `cellSize`
+         * bytes.
+         */
+        explicit Program(
+                std::vector<instruction_t> instructions,
+                std::size_t cellSize = 1,
+                std::size_t cellCount = 30000)
+            : instructions_(std::move(instructions)), cellSize_(cellSize), cellCount_(cellCount)
+        {
+        }
+
+        /** Get the instructions of the program. */
+        const std::vector<instruction_t>& instructions() const noexcept { return instructions_; }
+
+        /** Get the number of instructions in the program, including data words. */
+        std::size_t size() const noexcept { return instructions_.size(); }
+
+        /** Get the size in bytes of the memory cells the program was compiled for. */
+        std::size_t cellSize() const noexcept { return cellSize_; }
+
+        /** Get the number of memory cells the program was compiled for. */
+        std::size_t cellCount() const noexcept { return cellCount_; }
+
+        Program(const Program&) = delete;
+        Program& operator =(const Program&) = delete;
+
+    private:
+        const std::vector<instruction_t> instructions_;
+        const std::size_t cellSize_;
+        const std::size_t cellCount_;
+    };
+}
@@ -0,0 +1,176 @@
+// Copyright 2009-2020, Scott MacDonald.
+#include "scan.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+// SSE2 is part of the x86-64 baseline so the vector kernels need no runtime feature detection. Other hosts and
+// compilers use the scalar loops.
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#   define BF_SCAN_SSE2 1
+#   include <emmintrin.h>
+#else
+#   define BF_SCAN_SSE2 0
+#endif
+
+using namespace Brainfreeze;
+
+namespace
+{
+    /** Distance in cells that is checked one step at a time before switching to a block search. */
+    constexpr std::size_t ShortScanSize = 64;
+
+#if BF_SCAN_SSE2
+    constexpr std::size_t BlockSize = 16;
+
+    /** Get a bit mask with one bit set for each zero byte in the 16 bytes starting at `p`. */
+    inline unsigned ZeroMask(const int8_t* p) noexcept
+    {
+        auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_setzero_si128())));
+    }
+
+    /** Get a mask with a bit set for every multiple of the stride within a block, starting at bit zero. */
+    inline unsigned LandingPattern(std::size_t stride) noexcept
+    {
+        unsigned mask = 0;
+
+        for (std::size_t i = 0; i < BlockSize; i += stride)
+        {
+            mask |= 1u << i;
+        }
+
+        return mask;
+    }
+
+    /** Reverse the order of the bits in a block mask. */
+    inline unsigned Reverse(unsigned mask) noexcept
+    {
+        unsigned reversed = 0;
+
+        for (std::size_t i = 0; i < BlockSize; ++i)
+        {
+            reversed |= ((mask >> i) & 1u) << (BlockSize - 1 - i);
+        }
+
+        return reversed;
+    }
+#endif
+
+    /** Round a distance up to the next multiple of the stride. */
+    inline std::size_t RoundUp(std::size_t distance, std::size_t stride) noexcept
+    {
+        return ((distance + stride - 1) / stride) * stride;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+int8_t* Brainfreeze::ScanRight(int8_t* start, const int8_t* end, std::size_t stride) noexcept
+{
+    assert(stride > 0);
+    assert(start <= end);
+
+    const auto size = static_cast<std::size_t>(end - start);
+    std::size_t distance = 0;
+
+    // Most scans stop after a few steps, so check the nearby cells before setting up a block search.
+    for (const auto nearby = std::min(size, ShortScanSize); distance < nearby; distance += stride)
+    {
+        if (start[distance] == 0)
+        {
+            return start + distance;
+        }
+    }
+
+    if (stride == 1)
+    {
+        return static_cast<int8_t*>(std::memchr(start + distance, 0, size - distance));
+    }
+
+#if BF_SCAN_SSE2
+    // Compare a block at a time and mask off the bytes the scan steps over. The block size is not a multiple of
+    // every stride, so shift the landing pattern by how far the block starts from the previous landing spot.
+    if (stride < VectorScanStrideLimit)
+    {
+        const auto landings = LandingPattern(stride);
+
+        for (; distance + BlockSize <= size; distance += BlockSize)
+        {
+            auto shift = (stride - distance % stride) % stride;
+
+            if (auto hits = ZeroMask(start + distance) & (landings << shift); hits != 0)
+            {
+                return start + distance + __builtin_ctz(hits);
+            }
+        }
+    }
+#endif
+
+    for (distance = RoundUp(distance, stride); distance < size; distance += stride)
+    {
+        if (start[distance] == 0)
+        {
+            return start + distance;
+        }
+    }
+
+    return nullptr;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+int8_t* Brainfreeze::ScanLeft(int8_t* start, const int8_t* begin, std::size_t stride) noexcept
+{
+    assert(stride > 0);
+    assert(begin <= start);
+
+    // Distances are measured leftwards from the start, and the cell at the largest distance is the first cell.
+    const auto size = static_cast<std::size_t>(start - begin) + 1;
+    std::size_t distance = 0;
+
+    for (const auto nearby = std::min(size, ShortScanSize); distance < nearby; distance += stride)
+    {
+        if (*(start - distance) == 0)
+        {
+            return start - distance;
+        }
+    }
+
+#if defined(__GLIBC__)
+    if (stride == 1)
+    {
+        return static_cast<int8_t*>(memrchr(start - (size - 1), 0, size - distance));
+    }
+#endif
+
+#if BF_SCAN_SSE2
+    // Each block ends `distance` cells to the left of the start, so byte i of the block is (distance + 15 - i) cells
+    // away. Mirror the landing pattern so it counts from the end of the block, and the nearest hit is the highest
+    // set bit.
+    if (stride < VectorScanStrideLimit)
+    {
+        const auto landings = Reverse(LandingPattern(stride));
+
+        for (; distance + BlockSize <= size; distance += BlockSize)
+        {
+            auto blockStart = start - distance - (BlockSize - 1);
+            auto shift = (stride - distance % stride) % stride;
+
+            if (auto hits = ZeroMask(blockStart) & (landings >> shift); hits != 0)
+            {
+                return blockStart + (31 - __builtin_clz(hits));
+            }
+        }
+    }
+#endif
+
+    for (distance = RoundUp(distance, stride); distance < size; distance += stride)
+    {
+        if (*(start - distance) == 0)
+        {
+            return start - distance;
+        }
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,59 @@
+// Copyright 2009-2020, Scott MacDonald.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace Brainfreeze
+{
+    /**
+     * Scans with a stride at or above this land on too few cells per vector block for a vector search to beat
+     * stepping through memory one landing spot at a time, so they are always done with a simple loop.
+     */
+    constexpr std::size_t VectorScanStrideLimit = 8;
+
+    /**
+     * Find the first zero cell at or after `start` whose distance from `start` is a multiple of `stride`, which is
+     * what a loop like [>] or [>>>] does. Returns null if there is no such cell before `end`.
+     */
+    int8_t* ScanRight(int8_t* start, const int8_t* end, std::size_t stride) noexcept;
+
+    /**
+     * Find the first zero cell at or before `start` whose distance from `start` is a multiple of `stride`, which is
+     * what a loop like [<] or [<<<] does. Returns null if there is no such cell at or after `begin`.
+     */
+    int8_t* ScanLeft(int8_t* start, const int8_t* begin, std::size_t stride) noexcept;
+
+    /** ScanRight for cells wider than a byte, which steps through memory one landing spot at a time. */
+    template<typename Cell>
+    Cell* ScanRight(Cell* start, const Cell* end, std::size_t stride) noexcept
+    {
+        const auto size = static_cast<std::size_t>(end - start);
+
+        for (std::size_t distance = 0; distance < size; distance += stride)
+        {
+            if (start[distance] == 0)
+            {
+                return start + distance;
+            }
+        }
+
+        return nullptr;
+    }
+
+    /** ScanLeft for cells wider than a byte, which steps through memory one landing spot at a time. */
+    template<typename Cell>
+    Cell* ScanLeft(Cell* start, const Cell* begin, std::size_t stride) noexcept
+    {
+        const auto size = static_cast<std::size_t>(start - begin) + 1;
+
+        for (std::size_t distance = 0; distance < size; distance += stride)
+        {
+            if (*(start - distance) == 0)
+            {
+                return start - distance;
+            }
+        }
+
+        return nullptr;
+    }
+}
@@ -0,0 +1,514 @@
+// Copyright 2009-2020, Scott MacDonald.
+#include "tape.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+
+// Guard regions rely on POSIX memory mapping and signals. Everywhere else the tape is an ordinary allocation.
+#if defined(__unix__) || defined(__APPLE__)
+#   define BF_TAPE_MMAP 1
+#   include <csetjmp>
+#   include <csignal>
+#   include <sys/mman.h>
+#   include <unistd.h>
+#else
+#   define BF_TAPE_MMAP 0
+#endif
+
+using namespace Brainfreeze;
+
+#if BF_TAPE_MMAP
+namespace
+{
+    /** A call to Tape::runGuarded that is in progress on this thread. */
+    struct guarded_run_t
+    {
+        Tape* tape;
+        guarded_run_t* previous;
+        Tape::Fault fault;
+        const void* faultAddress;
+        sigjmp_buf jump;
+    };
+
+    thread_local guarded_run_t* ActiveRun = nullptr;
+
+    std::mutex HandlerMutex;
+    std::size_t HandlerUsers = 0;
+    struct sigaction PreviousSegvAction;
+    struct sigaction PreviousBusAction;
+
+    /** Pass a fault that did not hit a guard region on to the handler that was installed before ours. */
+    void ForwardFault(int signal, siginfo_t* info, void* context)
+    {
+        auto& previous = (signal == SIGBUS ? PreviousBusAction : PreviousSegvAction);
+
+        if ((previous.sa_flags & SA_SIGINFO) != 0)
+        {
+            previous.sa_sigaction(signal, info, context);
+        }
+        else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+        {
+            previous.sa_handler(signal);
+        }
+        else
+        {
+            // Returning retries the faulting access, which then gets the default action and ends the process.
+            std::signal(signal, SIG_DFL);
+        }
+    }
+
+    /**
+     * Signal handler for faults in the innermost guarded run on this thread. Returning after the tape commits the
+     * page retries the access, and faults the tape cannot fix abandon the run.
+     */
+    void OnFault(int signal, siginfo_t* info, void* context)
+    {
+        if (auto* run = ActiveRun; run != nullptr)
+        {
+            const auto fault = run->tape->handleFault(info->si_addr);
+
+            if (fault == Tape::Fault::Committed)
+            {
+                return;
+            }
+            else if (fault != Tape::Fault::NotTape)
+            {
+                run->fault = fault;
+                run->faultAddress = info->si_addr;
+                siglongjmp(run->jump, 1);
+            }
+        }
+
+        ForwardFault(signal, info, context);
+    }
+
+    /** Installs the fault handler while any guarded run is in progress, and restores the previous handlers after. */
+    class FaultHandlerScope
+    {
+    public:
+        FaultHandlerScope()
+        {
+            std::lock_guard<std::mutex> lock(HandlerMutex);
+
+            if (HandlerUsers++ == 0)
+            {
+                struct sigaction action = {};
+                action.sa_sigaction = &OnFault;
+                action.sa_flags = SA_SIGINFO;
+                sigemptyset(&action.sa_mask);
+
+                sigaction(SIGSEGV, &action, &PreviousSegvAction);
+                sigaction(SIGBUS, &action, &PreviousBusAction);
+            }
+        }
+
+        ~FaultHandlerScope()
+        {
+            std::lock_guard<std::mutex> lock(HandlerMutex);
+
+            if (--HandlerUsers == 0)
+            {
+                sigaction(SIGSEGV, &PreviousSegvAction, nullptr);
+                sigaction(SIGBUS, &PreviousBusAction, nullptr);
+            }
+        }
+
+        FaultHandlerScope(const FaultHandlerScope&) = delete;
+        FaultHandlerScope& operator =(const FaultHandlerScope&) = delete;
+    };
+
+    /** Makes a guarded run the innermost one on this thread for as long as it is in scope. */
+    class ActiveRunScope
+    {
+    public:
+        explicit ActiveRunScope(guarded_run_t& run) noexcept
+            : run_(run)
+        {
+            run_.previous = ActiveRun;
+            ActiveRun = &run_;
+        }
+
+        ~ActiveRunScope()
+        {
+            ActiveRun = run_.previous;
+        }
+
+        ActiveRunScope(const ActiveRunScope&) = delete;
+        ActiveRunScope& operator =(const ActiveRunScope&) = delete;
+
+    private:
+        guarded_run_t& run_;
+    };
+
+    const auto PageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+
+    std::size_t RoundUp(std::size_t value, std::size_t multiple) noexcept
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    /** Reserve inaccessible address space. */
+    void* Reserve(std::size_t size)
+    {
+        auto reserved = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (reserved == MAP_FAILED)
+        {
+            throw std::bad_alloc();
+        }
+
+        return reserved;
+    }
+}
+#endif
+
+//---------------------------------------------------------------------------------------------------------------------
+Tape::Tape(std::size_t size, std::size_t guardSize)
+{
+#if BF_TAPE_MMAP
+    // Reserve the tape, its guard regions and room to align the tape as one inaccessible mapping, and then open up the
+    // pages holding the tape. The tape is placed so that it ends right where the guard region after it starts, which
+    // leaves any slack on its first page. The engines check that the memory pointer never moves before the start of
+    // the tape, so only an offset access into the slack goes unnoticed.
+    const auto alignment = (size >= HugePageSize ? HugePageSize : PageSize);
+    const auto tapeSize = RoundUp(size, PageSize);
+    const auto guardRegionSize = RoundUp(guardSize > 0 ? guardSize : 1, PageSize);
+
+    guardSize_ = guardRegionSize;
+    reservedSize_ = guardRegionSize + (alignment - PageSize) + tapeSize + guardRegionSize;
+    reserved_ = Reserve(reservedSize_);
+
+    auto* tapeStart = reinterpret_cast<int8_t*>(
+        RoundUp(reinterpret_cast<std::uintptr_t>(reserved_) + guardRegionSize, alignment));
+    data_ = tapeStart + (tapeSize - size);
+
+    if (tapeSize > 0 && mprotect(tapeStart, tapeSize, PROT_READ | PROT_WRITE) != 0)
+    {
+        munmap(reserved_, reservedSize_);
+        throw std::bad_alloc();
+    }
+
+#   if defined(MADV_HUGEPAGE)
+    if (size >= HugePageSize)
+    {
+        // Only a hint, the tape works the same with ordinary pages.
+        madvise(tapeStart, tapeSize, MADV_HUGEPAGE);
+    }
+#   endif
+#else
+    (void)guardSize;
+    data_ = static_cast<int8_t*>(std::calloc(size > 0 ? size : 1, 1));
+
+    if (data_ == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+#endif
+
+    begin_ = data_;
+    end_ = data_ + size;
+    committedBegin_ = begin_;
+    committedEnd_ = end_;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::unique_ptr<Tape> Tape::createGrowing(std::size_t maxSize, std::size_t guardSize)
+{
+    std::unique_ptr<Tape> tape(new Tape());
+
+#if BF_TAPE_MMAP
+    // Cell zero sits between two halves that are each a page larger than the memory limit, which is further than the
+    // committed range can reach in one direction. Running off either end of the tape exceeds the memory limit first.
+    const auto limit = RoundUp(maxSize, PageSize);
+    const auto halfSize = limit + PageSize;
+    const auto guardRegionSize = RoundUp(guardSize > 0 ? guardSize : 1, PageSize);
+
+    tape->guardSize_ = guardRegionSize;
+    tape->reservedSize_ = guardRegionSize + halfSize + halfSize + guardRegionSize;
+    tape->reserved_ = Reserve(tape->reservedSize_);
+    tape->kind_ = Kind::Growing;
+    tape->maxSize_ = limit;
+
+    tape->begin_ = static_cast<int8_t*>(tape->reserved_) + guardRegionSize;
+    tape->data_ = tape->begin_ + halfSize;
+    tape->end_ = tape->data_ + halfSize;
+    tape->committedBegin_ = tape->data_;
+    tape->committedEnd_ = tape->data_;
+
+    // Start with the block after cell zero committed. If it does not fit then the first touch reports the error.
+    if (!tape->commit(tape->data_, GrowthSize))
+    {
+        tape->commit(tape->data_, PageSize);
+    }
+#else
+    (void)guardSize;
+    tape->begin_ = static_cast<int8_t*>(std::calloc(maxSize > 0 ? maxSize : 1, 1));
+
+    if (tape->begin_ == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    tape->data_ = tape->begin_ + maxSize / 2;
+    tape->end_ = tape->begin_ + maxSize;
+    tape->committedBegin_ = tape->begin_;
+    tape->committedEnd_ = tape->end_;
+#endif
+
+    return tape;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::unique_ptr<Tape> Tape::createSparse(std::size_t size, std::size_t maxSize, std::size_t guardSize)
+{
+#if BF_TAPE_MMAP
+    std::unique_ptr<Tape> tape(new Tape());
+
+    // Unlike a fixed tape none of the pages are opened up yet, and huge pages are not used since they would commit
+    // far more memory than the one page that was touched. Like a fixed tape it ends right at the guard region after
+    // it.
+    const auto tapeSize = RoundUp(size, PageSize);
+    const auto guardRegionSize = RoundUp(guardSize > 0 ? guardSize : 1, PageSize);
+
+    tape->guardSize_ = guardRegionSize;
+    tape->reservedSize_ = guardRegionSize + tapeSize + guardRegionSize;
+    tape->reserved_ = Reserve(tape->reservedSize_);
+    tape->kind_ = Kind::Sparse;
+    tape->maxSize_ = maxSize;
+
+    tape->begin_ = static_cast<int8_t*>(tape->reserved_) + guardRegionSize + (tapeSize - size);
+    tape->data_ = tape->begin_;
+    tape->end_ = tape->begin_ + size;
+    tape->committedPages_.resize(tapeSize / PageSize, false);
+
+    return tape;
+#else
+    (void)maxSize;
+    return std::make_unique<Tape>(size, guardSize);
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+Tape::~Tape()
+{
+#if BF_TAPE_MMAP
+    if (reserved_ != nullptr)
+    {
+        munmap(reserved_, reservedSize_);
+    }
+#else
+    std::free(begin_);
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::size_t Tape::committedSize() const noexcept
+{
+#if BF_TAPE_MMAP
+    if (isSparse())
+    {
+        return committedPageCount_ * PageSize;
+    }
+#endif
+
+    return static_cast<std::size_t>(committedEnd_ - committedBegin_);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool Tape::isCommitted(const void* address) const noexcept
+{
+#if BF_TAPE_MMAP
+    if (isSparse())
+    {
+        return address >= begin_ && address < end_ && committedPages_[pageIndex(static_cast<const int8_t*>(address))];
+    }
+#endif
+
+    return address >= committedBegin_ && address < committedEnd_;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+Tape::Fault Tape::handleFault(const void* address) noexcept
+{
+#if BF_TAPE_MMAP
+    const auto at = reinterpret_cast<std::uintptr_t>(address);
+    const auto reservedBegin = reinterpret_cast<std::uintptr_t>(reserved_);
+    const auto reservedEnd = reservedBegin + reservedSize_;
+
+    if (!hasGuards())
+    {
+        return Fault::NotTape;
+    }
+    else if (at < reservedBegin || at >= reservedEnd)
+    {
+        // The engines keep the memory pointer inside the tape, so this should not happen. A fault just past either
+        // end of the reservation is still reported as the tape being overrun, since it is on the tape's side of the
+        // guard region, and anything further away belongs to someone else.
+        const auto distance = (at < reservedBegin ? reservedBegin - at : at - reservedEnd + 1);
+        return distance <= guardSize_ ? Fault::OutOfBounds : Fault::NotTape;
+    }
+    else if (isSparse())
+    {
+        return commitPage(static_cast<const int8_t*>(address));
+    }
+    else if (!isGrowing())
+    {
+        return Fault::OutOfBounds;
+    }
+    else if (address < begin_ || address >= end_)
+    {
+        // Past either half the committed range would be larger than the memory limit.
+        return Fault::OutOfMemory;
+    }
+
+    // Commit a whole block so that code moving steadily through memory rarely faults, or only the page holding the
+    // address when a whole block would go over the memory limit.
+    const auto* byte = static_cast<const int8_t*>(address);
+    return (commit(byte, GrowthSize) || commit(byte, PageSize)) ? Fault::Committed : Fault::OutOfMemory;
+#else
+    (void)address;
+    return Fault::NotTape;
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool Tape::commit(const int8_t* address, std::size_t blockSize) noexcept
+{
+#if BF_TAPE_MMAP
+    // Grow the committed range to take in the aligned block holding the address. The range always holds cell zero and
+    // only ever grows, so it stays one contiguous range.
+    const auto at = static_cast<std::size_t>(address - begin_);
+    const auto blockBegin = begin_ + at / blockSize * blockSize;
+    const auto blockEnd = blockBegin + std::min(blockSize, static_cast<std::size_t>(end_ - blockBegin));
+
+    auto* newBegin = std::min(committedBegin_, blockBegin);
+    auto* newEnd = std::max(committedEnd_, blockEnd);
+
+    if (static_cast<std::size_t>(newEnd - newBegin) > maxSize_)
+    {
+        return false;
+    }
+
+    if (newBegin < committedBegin_)
+    {
+        if (mprotect(newBegin, static_cast<std::size_t>(committedBegin_ - newBegin), PROT_READ | PROT_WRITE) != 0)
+        {
+            return false;
+        }
+
+        committedBegin_ = newBegin;
+    }
+
+    if (newEnd > committedEnd_)
+    {
+        if (mprotect(committedEnd_, static_cast<std::size_t>(newEnd - committedEnd_), PROT_READ | PROT_WRITE) != 0)
+        {
+            return false;
+        }
+
+        committedEnd_ = newEnd;
+    }
+
+    return true;
+#else
+    (void)address;
+    (void)blockSize;
+    return false;
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::size_t Tape::pageIndex(const int8_t* address) const noexcept
+{
+#if BF_TAPE_MMAP
+    // The tape ends on a page boundary, so pages are counted back from the end.
+    return committedPages_.size() - 1 - static_cast<std::size_t>(end_ - 1 - address) / PageSize;
+#else
+    (void)address;
+    return 0;
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+Tape::Fault Tape::commitPage(const int8_t* address) noexcept
+{
+#if BF_TAPE_MMAP
+    // Bytes before the start of the tape that share its first page are out of bounds.
+    if (address < begin_ || address >= end_)
+    {
+        return Fault::OutOfBounds;
+    }
+
+    const auto page = pageIndex(address);
+    auto* pageStart = end_ - (committedPages_.size() - page) * PageSize;
+
+    if (committedPages_[page])
+    {
+        return Fault::Committed;
+    }
+    else if ((committedPageCount_ + 1) * PageSize > maxSize_)
+    {
+        return Fault::OutOfMemory;
+    }
+    else if (mprotect(pageStart, PageSize, PROT_READ | PROT_WRITE) != 0)
+    {
+        return Fault::OutOfMemory;
+    }
+
+    committedPages_[page] = true;
+    ++committedPageCount_;
+
+    return Fault::Committed;
+#else
+    (void)address;
+    return Fault::NotTape;
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Tape::runGuarded(
+    void (*function)(void*),
+    void* context,
+    void (*onFault)(void*, const void*),
+    void* faultContext)
+{
+#if BF_TAPE_MMAP
+    // The engines check every cell they touch, so only tapes that commit memory as it is touched need the handler.
+    // Leaving it out for fixed tapes keeps the process wide handler out of the way of embedders where it can be.
+    if (!hasGuards() || (!isGrowing() && !isSparse()))
+    {
+        function(context);
+        return;
+    }
+
+    // Both scopes outlive the jump back from the signal handler, so they are cleaned up on every path out.
+    FaultHandlerScope handler;
+    guarded_run_t run = { this, nullptr, Fault::NotTape, nullptr, {} };
+    ActiveRunScope active(run);
+
+    // The signal mask is saved so that the jump out of the signal handler restores it.
+    if (sigsetjmp(run.jump, 1) != 0)
+    {
+        onFault(faultContext, run.faultAddress);
+
+        if (run.fault == Fault::OutOfMemory)
+        {
+            throw std::runtime_error("Memory limit exceeded");
+        }
+
+        throw std::runtime_error(
+            run.faultAddress < data_ ?
+                "Memory pointer moved past the start of memory" :
+                "Memory pointer moved past the end of memory");
+    }
+
+    function(context);
+#else
+    (void)onFault;
+    (void)faultContext;
+    function(context);
+#endif
+}
@@ -0,0 +1,168 @@
+// Copyright 2009-2020, Scott MacDonald.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace Brainfreeze
+{
+    /**
+     * Memory for the cells of a running program.
+     *
+     * Where the host supports it the tape is reserved with mmap, so pages are only zeroed by the operating system when
+     * they are first touched and large tapes are allocated instantly. Large tapes ask for transparent huge pages. The
+     * tape is surrounded by inaccessible guard regions, and touching one while running code with runGuarded() stops
+     * that code with an exception. The execution engines check pointer moves and the range of cells each block of
+     * code touches at an offset, so the guard regions of a fixed tape only back those checks up and it runs without a
+     * fault handler. Elsewhere the tape is a plain zeroed allocation without guard regions.
+     *
+     * A growing tape has cells on both sides of cell zero and starts out with only the pages around it committed.
+     * Touching any other page while running guarded code commits it, until the memory limit would be exceeded.
+     *
+     * A sparse tape starts at cell zero like a fixed tape, but commits each page on its own when it is first touched
+     * and counts it against the memory limit. Programs that touch a few cells spread across a huge tape only pay for
+     * the pages they touch, and the hardware page tables take the place of a page directory.
+     */
+    class Tape
+    {
+    public:
+        /** Tapes at least this large are aligned to, and ask for, transparent huge pages. */
+        static constexpr std::size_t HugePageSize = 2 * 1024 * 1024;
+
+        /** Growing tapes commit memory in blocks of this many bytes, unless that would exceed the memory limit. */
+        static constexpr std::size_t GrowthSize = 64 * 1024;
+
+        /** What happened when guarded code touched memory it could not access. */
+        enum class Fault
+        {
+            NotTape,            ///< The address does not belong to the tape.
+            Committed,          ///< The page was committed and the access can be retried.
+            OutOfBounds,        ///< The address is in a guard region.
+            OutOfMemory         ///< Committing the page would exceed the memory limit.
+        };
+
+        /**
+         * Allocate a zero filled tape of `size` bytes. Each guard region is at least `guardSize` bytes, and should be
+         * larger than any distance code can reach past the memory pointer in one step.
+         */
+        Tape(std::size_t size, std::size_t guardSize);
+
+        /**
+         * Create a growing tape that commits at most `maxSize` bytes. Cell zero starts in the middle of a page more
+         * than `maxSize` bytes of address space on either side, so code running off either end of the tape exceeds the
+         * memory limit first. The tape is surrounded by guard regions of at least `guardSize` bytes.
+         * Hosts without memory mapping get a fixed tape of `maxSize` bytes with cell zero in the middle.
+         */
+        static std::unique_ptr<Tape> createGrowing(std::size_t maxSize, std::size_t guardSize);
+
+        /**
+         * Create a sparse tape of `size` bytes that commits at most `maxSize` bytes of pages, surrounded by guard
+         * regions of at least `guardSize` bytes. Hosts without memory mapping get a fixed tape of `size` bytes.
+         */
+        static std::unique_ptr<Tape> createSparse(std::size_t size, std::size_t maxSize, std::size_t guardSize);
+
+        /** Destructor, releases the tape. */
+        ~Tape();
+
+        /** Get cell zero of the tape. */
+        int8_t* data() noexcept { return data_; }
+
+        /** Get cell zero of the tape. */
+        const int8_t* data() const noexcept { return data_; }
+
+        /** Get the first byte that code can address, which is cell zero unless the tape is growing. */
+        int8_t* begin() noexcept { return begin_; }
+
+        /** Get the first byte that code can address, which is cell zero unless the tape is growing. */
+        const int8_t* begin() const noexcept { return begin_; }
+
+        /** Get the byte after the last byte that code can address. */
+        int8_t* end() noexcept { return end_; }
+
+        /** Get the byte after the last byte that code can address. */
+        const int8_t* end() const noexcept { return end_; }
+
+        /** Check if an address is between begin() and end(). */
+        bool contains(const void* address) const noexcept { return address >= begin_ && address < end_; }
+
+        /** Check if the tape commits memory as it is touched. */
+        bool isGrowing() const noexcept { return kind_ == Kind::Growing; }
+
+        /** Check if the tape commits each page on its own as it is touched. */
+        bool isSparse() const noexcept { return kind_ == Kind::Sparse; }
+
+        /** Get the number of bytes that are committed and can be accessed without a fault. */
+        std::size_t committedSize() const noexcept;
+
+        /** Check if the byte at an address is committed, which means it can be read outside of guarded code. */
+        bool isCommitted(const void* address) const noexcept;
+
+        /** Check if the tape is surrounded by guard regions. */
+        bool hasGuards() const noexcept { return reservedSize_ > 0; }
+
+        /** Handle a fault at an address, which commits the page holding it when that is allowed. */
+        Fault handleFault(const void* address) noexcept;
+
+        /**
+         * Call `function`, and if it touches a guard region or exceeds the memory limit abandon the call, pass the
+         * faulting address to `onFault` and throw std::runtime_error saying why. Growing and sparse tapes install a
+         * process wide SIGSEGV and SIGBUS handler for the duration of the call to commit pages as they are touched,
+         * and fixed tapes just call `function`.
+         *
+         * The function is left with siglongjmp from the signal handler, which skips destructors and catch blocks. No
+         * frame with an object that has a non-trivial destructor or with a try block may sit between here and an
+         * access that can fault, so anything that can touch uncommitted memory must be plain engine code: console
+         * callbacks check isCommitted() and commit cells up front instead. Whatever state the function kept in locals
+         * is lost.
+         */
+        template<typename Function, typename FaultFunction>
+        void runGuarded(Function&& function, FaultFunction&& onFault)
+        {
+            using function_t = std::remove_reference_t<Function>;
+            using fault_function_t = std::remove_reference_t<FaultFunction>;
+
+            runGuarded(
+                [](void* context) { (*static_cast<function_t*>(context))(); },
+                &function,
+                [](void* context, const void* address) { (*static_cast<fault_function_t*>(context))(address); },
+                &onFault);
+        }
+
+        Tape(const Tape&) = delete;
+        Tape& operator =(const Tape&) = delete;
+
+    private:
+        Tape() = default;
+        void runGuarded(
+            void (*function)(void*),
+            void* context,
+            void (*onFault)(void*, const void*),
+            void* faultContext);
+        bool commit(const int8_t* address, std::size_t blockSize) noexcept;
+        Fault commitPage(const int8_t* address) noexcept;
+        std::size_t pageIndex(const int8_t* address) const noexcept;
+
+        enum class Kind
+        {
+            Fixed,
+            Growing,
+            Sparse
+        };
+
+    private:
+        int8_t* data_ = nullptr;
+        int8_t* begin_ = nullptr;
+        int8_t* end_ = nullptr;
+        Kind kind_ = Kind::Fixed;
+        int8_t* committedBegin_ = nullptr;      ///< Committed range of fixed and growing tapes.
+        int8_t* committedEnd_ = nullptr;
+        std::vector<bool> committedPages_;      ///< Which pages of a sparse tape are committed.
+        std::size_t committedPageCount_ = 0;
+        std::size_t maxSize_ = 0;               ///< Most bytes a growing or sparse tape commits.
+        void* reserved_ = nullptr;              ///< Start of the mapping holding the tape and its guard regions.
+        std::size_t reservedSize_ = 0;          ///< Size of the mapping, or zero if the tape has no guard regions.
+        std::size_t guardSize_ = 0;             ///< Size of each guard region.
+    };
+}
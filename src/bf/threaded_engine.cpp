@@ -0,0 +1,373 @@
+// Copyright 2009-2020, Scott MacDonald.
+#include "bf/bf.h"
+#include "bf/helpers.h"
+#include "bf/iconsole.h"
+#include "engine.h"
+#include "scan.h"
+#include "tape.h"
+#include "threaded_engine.h"
+
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#if BF_USE_COMPUTED_GOTO
+#   pragma GCC diagnostic push
+#   pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+using namespace Brainfreeze;
+
+namespace
+{
+    /**
+     * Pre-translate a program into threaded form using a table of handlers indexed by opcode. Far jumps are
+     * translated to ordinary jumps, and their extension words to no-ops so the instruction indices stay the same.
+     */
+    std::vector<threaded_instruction_t> Translate(
+        const std::vector<instruction_t>& instructions,
+        const handler_t* handlers,
+        std::size_t handlerCount)
+    {
+        std::vector<threaded_instruction_t> threaded;
+        threaded.reserve(instructions.size());
+
+        for (auto itr = instructions.begin(); itr != instructions.end(); ++itr)
+        {
+            if (static_cast<size_t>(itr->opcode()) >= handlerCount)
+            {
+                throw std::runtime_error("unknown instruction opcode");
+            }
+
+            threaded_instruction_t t{ handlers[static_cast<size_t>(itr->opcode())], itr->param(), itr->offset() };
+
+            // Jumps and conditional skips that were not linked do not carry their target so find it once now rather
+            // than on every execution.
+            if (itr->isA(OpcodeType::JumpForward) || itr->isA(OpcodeType::JumpBack) ||
+                (itr->isA(OpcodeType::IfZeroSkip) && itr->param() == 0))
+            {
+                auto target = Helpers::FindJumpTarget(instructions.begin(), instructions.end(), itr);
+                t.param = static_cast<int32_t>(target > itr ? target - itr : itr - target);
+            }
+            else if (itr->isA(OpcodeType::FarJumpForward) ||
+                itr->isA(OpcodeType::FarJumpBack) ||
+                itr->isA(OpcodeType::FarIfZeroSkip))
+            {
+                // Both ends of a far jump are followed by an extension word, so land one instruction further along
+                // than an ordinary jump would. A far IfZeroSkip lands on its EndIf like an ordinary one. Falling
+                // through runs the extension word's no-op.
+                auto distance = static_cast<int32_t>(itr->farDistance(*(itr + 1)));
+                t.param = (itr->isA(OpcodeType::FarJumpForward) ? distance + 1 :
+                    itr->isA(OpcodeType::FarJumpBack) ? distance - 1 : distance);
+
+                threaded.push_back(t);
+                threaded.push_back({ handlers[static_cast<size_t>(OpcodeType::NoOperation)], 0, 0 });
+                ++itr;
+                continue;
+            }
+
+            threaded.push_back(t);
+        }
+
+        return threaded;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Interpreter::runThreaded()
+{
+    WithEnginePolicies(cellSize_, endOfStreamBehavior_, [this](auto cell, auto endOfStream) {
+        executeThreaded<decltype(cell), decltype(endOfStream)::value>();
+    });
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+template<typename Cell, Interpreter::EndOfStreamBehavior EndOfStream>
+void Interpreter::executeThreaded()
+{
+    const auto& instructions = program_->instructions();
+
+    assert(state_ == RunState::Running);
+    assert(!instructions.empty() && instructions.back().isA(OpcodeType::EndOfStream));
+    assert(cellSize_ == sizeof(Cell));
+
+    // Handler table indexed by opcode value. Unused opcode values map to the invalid opcode handler.
+#if BF_USE_COMPUTED_GOTO
+    static const handler_t Handlers[] =
+    {
+        &&op_EndOfStream,       // 0 EndOfStream
+        &&op_NoOperation,       // 1 NoOperation
+        &&op_PtrInc,            // 2 PtrInc
+        &&op_PtrDec,            // 3 PtrDec
+        &&op_MemInc,            // 4 MemInc
+        &&op_MemDec,            // 5 MemDec
+        &&op_Read,              // 6 Read
+        &&op_Write,             // 7 Write
+        &&op_Invalid,           // 8 (unused)
+        &&op_JumpForward,       // 9 JumpForward
+        &&op_JumpBack,          // 10 JumpBack
+        &&op_JumpForward,       // 11 FastJumpForward
+        &&op_JumpBack,          // 12 FastJumpBack
+        &&op_SetZero,           // 13 SetZero
+        &&op_SetValue,          // 14 SetValue
+        &&op_MulAdd,            // 15 MulAdd
+        &&op_ScanRight,         // 16 ScanRight
+        &&op_ScanLeft,          // 17 ScanLeft
+        &&op_JumpForward,       // 18 FarJumpForward
+        &&op_JumpBack,          // 19 FarJumpBack
+        &&op_PrintString,       // 20 PrintString
+        &&op_IfZeroSkip,        // 21 IfZeroSkip
+        &&op_NoOperation,       // 22 EndIf
+        &&op_ProductAdd,        // 23 ProductAdd
+        &&op_Invalid,           // 24 Extension
+        &&op_IfZeroSkip,        // 25 FarIfZeroSkip
+        &&op_CheckRange,        // 26 CheckRange
+        &&op_CheckRangeIfNonZero // 27 CheckRangeIfNonZero
+    };
+
+#   define BF_CASE(name) op_##name
+#   define BF_DISPATCH() goto *ip->handler
+#else
+    static const handler_t Handlers[] =
+    {
+        OpcodeType::EndOfStream,
+        OpcodeType::NoOperation,
+        OpcodeType::PtrInc,
+        OpcodeType::PtrDec,
+        OpcodeType::MemInc,
+        OpcodeType::MemDec,
+        OpcodeType::Read,
+        OpcodeType::Write,
+        static_cast<OpcodeType>(8),
+        OpcodeType::JumpForward,
+        OpcodeType::JumpBack,
+        OpcodeType::JumpForward,
+        OpcodeType::JumpBack,
+        OpcodeType::SetZero,
+        OpcodeType::SetValue,
+        OpcodeType::MulAdd,
+        OpcodeType::ScanRight,
+        OpcodeType::ScanLeft,
+        OpcodeType::JumpForward,
+        OpcodeType::JumpBack,
+        OpcodeType::PrintString,
+        OpcodeType::IfZeroSkip,
+        OpcodeType::NoOperation,
+        OpcodeType::ProductAdd,
+        OpcodeType::Extension,
+        OpcodeType::IfZeroSkip,
+        OpcodeType::CheckRange,
+        OpcodeType::CheckRangeIfNonZero
+    };
+
+#   define BF_CASE(name) case OpcodeType::name
+#   define BF_DISPATCH() continue
+#endif
+
+    threadedProgram_ = std::make_unique<threaded_program_t>();
+    threadedProgram_->instructions = Translate(instructions, Handlers, sizeof(Handlers) / sizeof(Handlers[0]));
+
+    const auto* const code = threadedProgram_->instructions.data();
+    const auto* ip = code + (ip_ - instructions.begin());
+
+    // Memory is allocated as bytes and accessed as cells.
+    auto* const tape = reinterpret_cast<Cell*>(memory_->begin());
+    auto* const tapeEnd = reinterpret_cast<Cell*>(memory_->end());
+    auto* mp = reinterpret_cast<Cell*>(mp_);
+
+    // Copy the instruction and memory pointers back into the interpreter, which is required before anything that
+    // can observe them (console callbacks, exceptions and program termination).
+    auto syncState = [&]() {
+        ip_ = instructions.begin() + (ip - code);
+        mp_ = reinterpret_cast<byte_t*>(mp);
+    };
+
+#if BF_USE_COMPUTED_GOTO
+    BF_DISPATCH();
+#else
+    for (;;)
+    {
+        switch (ip->handler)
+        {
+#endif
+
+    BF_CASE(NoOperation):
+        ++ip;
+        BF_DISPATCH();
+
+    BF_CASE(PtrInc):
+        // Pointer moves are checked, and cells touched at an offset are covered by the compiler's range checks.
+        if (ip->param >= tapeEnd - mp)
+        {
+            syncState();
+            throw std::runtime_error("Memory pointer moved past the end of memory");
+        }
+
+        mp += ip->param;
+        ++ip;
+        BF_DISPATCH();
+
+    BF_CASE(PtrDec):
+        if (ip->param > mp - tape)
+        {
+            syncState();
+            throw std::runtime_error("Memory pointer moved past the start of memory");
+        }
+
+        mp -= ip->param;
+        ++ip;
+        BF_DISPATCH();
+
+    BF_CASE(MemInc):
+        AddToCell(mp[ip->offset], ip->param);
+        ++ip;
+        BF_DISPATCH();
+
+    BF_CASE(MemDec):
+        AddToCell(mp[ip->offset], -ip->param);
+        ++ip;
+        BF_DISPATCH();
+
+    BF_CASE(SetZero):
+        mp[ip->offset] = 0;
+        ++ip;
+        BF_DISPATCH();
+
+    BF_CASE(SetValue):
+        mp[ip->offset] = static_cast<Cell>(ip->param);
+        ++ip;
+        BF_DISPATCH();
+
+    BF_CASE(MulAdd):
+        if (*mp != 0)
+        {
+            AddToCell(mp[ip->offset], MultiplyCell(*mp, ip->param));
+        }
+        ++ip;
+        BF_DISPATCH();
+
+    BF_CASE(ProductAdd):
+        // The second factor's offset is in the no-op word that follows, which is skipped.
+        if (*mp != 0)
+        {
+            AddToCell(mp[ip->offset], MultiplyCell(*mp, MultiplyCell(mp[ip[1].offset], ip->param)));
+        }
+        ip += 2;
+        BF_DISPATCH();
+
+    BF_CASE(CheckRange):
+        // The range of offsets is from the offset to the parameter.
+        if (ip->offset < tape - mp)
+        {
+            syncState();
+            throw std::runtime_error("Memory pointer moved past the start of memory");
+        }
+        else if (ip->param >= tapeEnd - mp)
+        {
+            syncState();
+            throw std::runtime_error("Memory pointer moved past the end of memory");
+        }
+
+        ++ip;
+        BF_DISPATCH();
+
+    BF_CASE(CheckRangeIfNonZero):
+        // Checks the cells of a run of multiply loop instructions, which are only touched when the current cell is
+        // non-zero.
+        if (*mp != 0 && ip->offset < tape - mp)
+        {
+            syncState();
+            throw std::runtime_error("Memory pointer moved past the start of memory");
+        }
+        else if (*mp != 0 && ip->param >= tapeEnd - mp)
+        {
+            syncState();
+            throw std::runtime_error("Memory pointer moved past the end of memory");
+        }
+
+        ++ip;
+        BF_DISPATCH();
+
+    BF_CASE(ScanRight):
+        if (auto found = ScanRight(mp, tapeEnd, ip->param); found != nullptr)
+        {
+            mp = found;
+            ++ip;
+            BF_DISPATCH();
+        }
+
+        syncState();
+        throw std::runtime_error("Scan moved the memory pointer past the end of memory");
+
+    BF_CASE(ScanLeft):
+        if (auto found = ScanLeft(mp, tape, ip->param); found != nullptr)
+        {
+            mp = found;
+            ++ip;
+            BF_DISPATCH();
+        }
+
+        syncState();
+        throw std::runtime_error("Scan moved the memory pointer past the start of memory");
+
+    BF_CASE(Write):
+        syncState();
+        ip += writeRun(mp, ip - code);
+        BF_DISPATCH();
+
+    BF_CASE(PrintString):
+        syncState();
+        ip += printString(ip - code);
+        BF_DISPATCH();
+
+    BF_CASE(Read):
+        syncState();
+        commitConsoleCell(mp + ip->offset);
+        mp[ip->offset] = readCell<Cell, EndOfStream>(mp[ip->offset]);
+        ++ip;
+        BF_DISPATCH();
+
+    BF_CASE(JumpForward):
+        // Only jump if byte at data pointer is zero.
+        assert(ip->param > 0);
+        ip += (*mp == 0 ? ip->param + 1 : 1);
+        BF_DISPATCH();
+
+    BF_CASE(IfZeroSkip):
+        // Like a forward jump but testing a cell at an offset. The matching EndIf runs as a no-op.
+        assert(ip->param > 0);
+        ip += (mp[ip->offset] == 0 ? ip->param + 1 : 1);
+        BF_DISPATCH();
+
+    BF_CASE(JumpBack):
+        // Only jump if byte at data pointer is non-zero.
+        assert(ip->param > 0);
+        ip += (*mp != 0 ? 1 - ip->param : 1);
+        BF_DISPATCH();
+
+    BF_CASE(EndOfStream):
+        syncState();
+        state_ = RunState::Finished;
+        return;
+
+#if BF_USE_COMPUTED_GOTO
+    op_Invalid:
+#else
+        default:
+#endif
+        syncState();
+        throw std::runtime_error("unknown instruction opcode");
+
+#if !BF_USE_COMPUTED_GOTO
+        }
+    }
+#endif
+
+#undef BF_CASE
+#undef BF_DISPATCH
+}
+
+#if BF_USE_COMPUTED_GOTO
+#   pragma GCC diagnostic pop
+#endif
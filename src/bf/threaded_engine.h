@@ -0,0 +1,44 @@
+// Copyright 2009-2020, Scott MacDonald.
+#pragma once
+#include "bf/bf.h"
+
+#include <cstdint>
+#include <vector>
+
+// Direct threading relies on the GCC "labels as values" extension (also supported by clang). Other compilers fall
+// back to a switch over the same pre-translated handler table.
+#if defined(__GNUC__) || defined(__clang__)
+#   define BF_USE_COMPUTED_GOTO 1
+#else
+#   define BF_USE_COMPUTED_GOTO 0
+#endif
+
+namespace Brainfreeze
+{
+#if BF_USE_COMPUTED_GOTO
+    using handler_t = const void*;
+#else
+    using handler_t = OpcodeType;
+#endif
+
+    /**
+     * An instruction translated for the threaded engine. The handler is the address of the code that executes the
+     * instruction, and jump parameters are resolved to relative offsets (even when the compiler did not precalculate
+     * them) so that every handler can move directly to the next one.
+     */
+    struct threaded_instruction_t
+    {
+        handler_t handler;
+        int32_t param;
+        int32_t offset;
+    };
+
+    /**
+     * A program translated for the threaded engine. The interpreter owns it rather than the engine so that it is still
+     * released when a guard region fault jumps out of the engine.
+     */
+    struct Interpreter::threaded_program_t
+    {
+        std::vector<threaded_instruction_t> instructions;
+    };
+}
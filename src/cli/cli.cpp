@@ -8,6 +8,8 @@
 
 #include <CLI11/CLI11.hpp>
 
+#include <algorithm>
+
 using namespace Brainfreeze;
 using namespace Brainfreeze::CommandLineApp;
 
@@ -30,17 +32,49 @@ int unguardedMain(int argc, char** argv)
         {"nochange", Interpreter::EndOfStreamBehavior::NoChange}
     });
 
+    const std::map<std::string, Interpreter::TapeMode> TapeLookupTable({
+        {"fixed", Interpreter::TapeMode::Fixed},
+        {"growing", Interpreter::TapeMode::Growing},
+        {"sparse", Interpreter::TapeMode::Sparse}
+    });
+
+    const std::map<std::string, Interpreter::ExecutionEngine> EngineLookupTable({
+        {"basic", Interpreter::ExecutionEngine::Basic},
+        {"threaded", Interpreter::ExecutionEngine::Threaded},
+        {"jit", Interpreter::ExecutionEngine::Jit},
+        {"tiered", Interpreter::ExecutionEngine::Tiered}
+    });
+
     std::string inputFilePath;
     auto endOfStreamBehavior = Interpreter::EndOfStreamBehavior::NegativeOne;
+    auto executionEngine = Interpreter::ExecutionEngine::Basic;
+    size_t tierUpThreshold = 1000;
 
     size_t cellCount = 30000;
     size_t blockSize = 1;
+    auto tapeMode = Interpreter::TapeMode::Fixed;
+    size_t maxMemory = 1024 * 1024 * 1024;
 
     bool convertInputCRLF = false;
     bool convertOutputLF = false;
     bool inputBuffering = true;
     bool shouldEchoInput = GConsole->shouldEchoCharForInput();
 
+    int optimizationLevel = Compiler::DefaultOptimizationLevel;
+    std::vector<std::string> enabledPasses;
+    std::vector<std::string> disabledPasses;
+    size_t partialEvaluationBudget = Compiler().partialEvaluationBudget();
+
+    std::vector<std::string> passNames;
+
+    for (size_t i = 0; i < CompilerPassCount; ++i)
+    {
+        passNames.push_back(std::string(Compiler::passName(static_cast<CompilerPass>(i))));
+    }
+
+    size_t outputBufferSize = 0;
+    size_t outputFlushLatency = 0;
+
     app.add_option("-f,--file,file", inputFilePath)
         ->description("Path to Brainfreeze program")
 #if _WIN32
@@ -60,6 +94,19 @@ int unguardedMain(int argc, char** argv)
         ->group("Brainfuck Details")
         ->type_name("<number>");
 
+    app.add_option("--tape", tapeMode)
+        ->description("How memory is allocated, growing tapes extend both ways and sparse tapes only use touched pages")
+        ->group("Brainfuck Details")
+        ->type_name("<mode>")
+        ->ignore_case()
+        ->transform(CLI::CheckedTransformer(TapeLookupTable, CLI::ignore_case));
+
+    app.add_option("--max-memory", maxMemory)
+        ->description("Most bytes of memory a growing or sparse tape can use before the program is stopped")
+        ->group("Brainfuck Details")
+        ->type_name("<bytes>")
+        ->check(CLI::PositiveNumber);
+
     app.add_option("-e,--eof", endOfStreamBehavior)
         ->description("End of stream behavior")
         ->group("Brainfuck Details")
@@ -68,6 +115,42 @@ int unguardedMain(int argc, char** argv)
         ->ignore_underscore()
         ->transform(CLI::CheckedTransformer(EOSLookupTable, CLI::ignore_case));
 
+    app.add_option("--engine", executionEngine)
+        ->description("Execution engine used to run the program")
+        ->group("Execution")
+        ->type_name("<engine>")
+        ->ignore_case()
+        ->transform(CLI::CheckedTransformer(EngineLookupTable, CLI::ignore_case));
+
+    app.add_option("--tierUpThreshold", tierUpThreshold)
+        ->description("Loop iterations before the tiered engine compiles a loop to native code")
+        ->group("Execution")
+        ->type_name("<number>")
+        ->check(CLI::PositiveNumber);
+
+    app.add_option("-O,--optimize", optimizationLevel)
+        ->description("Optimization level, where each level runs the passes of the level below and more")
+        ->group("Optimization")
+        ->type_name("<level>")
+        ->check(CLI::Range(Compiler::MinOptimizationLevel, Compiler::MaxOptimizationLevel));
+
+    app.add_option("--pass", enabledPasses)
+        ->description("Run a compiler pass even if the optimization level would not")
+        ->group("Optimization")
+        ->type_name("<name>")
+        ->check(CLI::IsMember(passNames));
+
+    app.add_option("--no-pass", disabledPasses)
+        ->description("Do not run a compiler pass even if the optimization level would")
+        ->group("Optimization")
+        ->type_name("<name>")
+        ->check(CLI::IsMember(passNames));
+
+    app.add_option("--partialEvalBudget", partialEvaluationBudget)
+        ->description("Most instructions run at compile time by the partial-eval pass")
+        ->group("Optimization")
+        ->type_name("<number>");
+
     app.add_flag("--echoInput", shouldEchoInput)
         ->description("Write input to output for display")
         ->group("Input/Output Behavior")
@@ -100,6 +183,16 @@ int unguardedMain(int argc, char** argv)
 #endif
         ->ignore_case();
 
+    auto outputBufferSizeOption = app.add_option("--outputBufferSize", outputBufferSize)
+        ->description("Bytes of output buffered before it is written (default depends on if output is redirected)")
+        ->group("Input/Output Behavior")
+        ->type_name("<bytes>");
+
+    auto outputFlushLatencyOption = app.add_option("--outputFlushLatency", outputFlushLatency)
+        ->description("Longest time in milliseconds buffered output waits before it is written, or 0 to never wait")
+        ->group("Input/Output Behavior")
+        ->type_name("<milliseconds>");
+
     // Parse command line options.
     CLI11_PARSE(app, argc, argv);
 
@@ -108,19 +201,54 @@ int unguardedMain(int argc, char** argv)
     GConsole->setShouldConvertOutputLFtoCRLF(convertOutputLF);
     GConsole->setInputBuffering(inputBuffering);
     GConsole->setInputEchoing(shouldEchoInput);
+
+    // Output buffering defaults are chosen by the console, so only override them when asked.
+    if (outputBufferSizeOption->count() > 0)
+    {
+        GConsole->setOutputBufferSize(outputBufferSize);
+    }
+
+    if (outputFlushLatencyOption->count() > 0)
+    {
+        GConsole->setOutputFlushLatency(std::chrono::milliseconds(outputFlushLatency));
+    }
     
     GConsole->setTitle(std::string("Brainfreeze: " + inputFilePath));
 
     try
     {
+        // Configure the compiler with the optimization level, and then any passes that were individually requested.
+        Compiler compiler;
+        compiler.setOptimizationLevel(optimizationLevel);
+        compiler.setPartialEvaluationBudget(partialEvaluationBudget);
+        compiler.setCellSize(blockSize);
+
+        // Partial evaluation must not use more cells than the program runs with. Growing tapes are only limited by
+        // the memory limit rather than the cell count.
+        compiler.setCellCount(
+            tapeMode == Interpreter::TapeMode::Growing ? std::max<size_t>(1, maxMemory / blockSize) : cellCount);
+
+        for (const auto& name : enabledPasses)
+        {
+            compiler.setPassEnabled(*Compiler::findPass(name), true);
+        }
+
+        for (const auto& name : disabledPasses)
+        {
+            compiler.setPassEnabled(*Compiler::findPass(name), false);
+        }
+
         // Load code from disk.
         // TODO: Print errors from code along with line/column and highlighting.
-        // TODO: Make the compiler configurable (like optimizations).
-        auto interpreter = Brainfreeze::Helpers::LoadFromDisk(inputFilePath);
+        auto interpreter = Brainfreeze::Helpers::LoadFromDisk(inputFilePath, compiler);
 
         interpreter->setCellCount(cellCount);
         interpreter->setCellSize(blockSize);
+        interpreter->setTapeMode(tapeMode);
+        interpreter->setMaxMemory(maxMemory);
         interpreter->setEndOfStreamBehavior(endOfStreamBehavior);
+        interpreter->setExecutionEngine(executionEngine);
+        interpreter->setTierUpThreshold(tierUpThreshold);
         interpreter->setConsole(std::move(GConsole));   // TODO: hmmm this is a problem
         
         // Now execute the program
@@ -159,7 +287,13 @@ int main(int argc, char* argv[])
     }
     catch (const std::exception& e)
     {
-        GConsole->setTextForegroundColor(AnsiColor::LightRed);
+        // The console belongs to the interpreter once execution starts, and is gone by the time a runtime error
+        // reaches here.
+        if (GConsole != nullptr)
+        {
+            GConsole->setTextForegroundColor(AnsiColor::LightRed);
+        }
+
         std::cerr << "*** UNHANDLED EXCEPTION ***" << std::endl;
         std::cerr << e.what() << std::endl;
 
@@ -36,6 +36,21 @@ void Console::writeLine(std::string_view message, OutputStreamName stream)
     write('\n', stream);
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+void Console::flushOutput()
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Console::setOutputBufferSize(size_t /*sizeInBytes*/)
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void Console::setOutputFlushLatency(std::chrono::milliseconds /*latency*/)
+{
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 bool Console::isRawInput() const
 {
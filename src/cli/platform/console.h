@@ -2,6 +2,8 @@
 #pragma once
 #include "bf/iconsole.h"
 
+#include <chrono>
+#include <cstddef>
 #include <string_view>
 #include <memory>
 
@@ -73,6 +75,18 @@ namespace Brainfreeze::CommandLineApp
         /** Write a string to standard output and move to the next line. */
         virtual void writeLine(std::string_view message, OutputStreamName stream);
 
+        /** Write any buffered standard output to the console. Consoles that do not buffer output do nothing. */
+        virtual void flushOutput();
+
+        /** Set how many bytes of standard output can be buffered before they are written to the console. */
+        virtual void setOutputBufferSize(size_t sizeInBytes);
+
+        /**
+         * Set the longest time buffered standard output can wait before it is written to the console. The time is
+         * checked when more output is written, and zero disables the check.
+         */
+        virtual void setOutputFlushLatency(std::chrono::milliseconds latency);
+
         /** Check if input is redirected from the console. */
         virtual bool isInputRedirected() const = 0;
 
@@ -4,11 +4,16 @@
 #include "unix_console.h"
 #include "../exceptions.h"
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cstring>
+#include <utility>
 
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 
 using namespace Brainfreeze;
 using namespace Brainfreeze::CommandLineApp;
@@ -82,6 +87,23 @@ namespace
         ansi_format_info_t { "Invert",    "\033[7m", "\033[27m" },
         ansi_format_info_t { "Underline", "\033[4m", "\033[24m" }
     };
+
+    /** Write end of the pipe that wakes the console's flush thread, used by the signal handler. */
+    volatile sig_atomic_t GFlushThreadPipe = -1;
+
+    /** Hand an interrupt or terminate signal to the flush thread, which flushes output and then re-raises it. */
+    void OnTerminatingSignal(int signal)
+    {
+        auto savedErrno = errno;
+        auto reason = static_cast<char>(signal);
+
+        if (GFlushThreadPipe >= 0 && ::write(GFlushThreadPipe, &reason, 1) < 0)
+        {
+            // Nothing can be done about it from a signal handler.
+        }
+
+        errno = savedErrno;
+    }
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -103,16 +125,80 @@ UnixConsole::UnixConsole()
         }
     }
     
-    // Disable output buffering.
+    // Disable the C library's output buffering because this console does its own block buffering. Redirected output
+    // is not watched by anyone so it can use a bigger buffer and skip the latency check.
     if (!isOutputRedirected())
     {
         setbuf(stdout, NULL);
     }
+    else
+    {
+        outputBufferSize_ = DefaultRedirectedOutputBufferSize;
+        outputFlushLatency_ = std::chrono::milliseconds::zero();
+    }
+
+    outputBuffer_.reserve(outputBufferSize_);
+
+    // Start the thread that flushes output which has waited too long, and have it flush when the process is stopped
+    // by a signal. Signals that were ignored when the console started stay ignored.
+    if (pipe(flushThreadPipe_) != 0)
+    {
+        raiseError(errno, "Failed to create output flush pipe", __FILE__, __LINE__);
+        flushThreadPipe_[0] = flushThreadPipe_[1] = -1;
+        return;
+    }
+
+    fcntl(flushThreadPipe_[1], F_SETFL, O_NONBLOCK);
+    GFlushThreadPipe = flushThreadPipe_[1];
+
+    struct sigaction action = {};
+    action.sa_handler = &OnTerminatingSignal;
+    sigemptyset(&action.sa_mask);
+
+    const std::pair<int, struct sigaction*> signals[] =
+    {
+        { SIGINT, &previousInterruptAction_ },
+        { SIGTERM, &previousTerminateAction_ }
+    };
+
+    for (auto [signal, previous] : signals)
+    {
+        sigaction(signal, nullptr, previous);
+
+        if (previous->sa_handler != SIG_IGN)
+        {
+            sigaction(signal, &action, nullptr);
+        }
+    }
+
+    flushThread_ = std::thread([this]() { runFlushThread(); });
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 UnixConsole::~UnixConsole()
 {
+    // Stop the flush thread and put the signal handlers back, and then write any output the program left in the
+    // buffer before it exited.
+    if (flushThread_.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(outputMutex_);
+            isFlushThreadStopping_ = true;
+        }
+
+        wakeFlushThread(0);
+        flushThread_.join();
+
+        sigaction(SIGINT, &previousInterruptAction_, nullptr);
+        sigaction(SIGTERM, &previousTerminateAction_, nullptr);
+        GFlushThreadPipe = -1;
+
+        close(flushThreadPipe_[0]);
+        close(flushThreadPipe_[1]);
+    }
+
+    flushOutput();
+
     // Restore old terminal parameters now that the console is being destroyed.
     if (didChangeTerminalParams)
     {
@@ -130,16 +216,23 @@ UnixConsole::~UnixConsole()
 //---------------------------------------------------------------------------------------------------------------------
 void UnixConsole::write(char d, OutputStreamName stream)
 {
-    auto handle = (stream == OutputStreamName::Stdout ? stdout : stderr);
+    if (stream == OutputStreamName::Stdout)
+    {
+        bufferOutput(std::string_view(&d, 1));
+        return;
+    }
+
+    // Standard error is not buffered, but anything already written to standard output must appear before it.
+    flushOutput();
     int status = 0;
 
     if (d == '\n' && shouldConvertOutputLFtoCRLF())
     {
-        status = fprintf(handle, "\r\n");
+        status = fprintf(stderr, "\r\n");
     }
     else
     {
-        status = fprintf(handle, "%c", d);
+        status = fprintf(stderr, "%c", d);
     }
 
     if (status < 0)
@@ -151,10 +244,16 @@ void UnixConsole::write(char d, OutputStreamName stream)
 //---------------------------------------------------------------------------------------------------------------------
 void UnixConsole::write(std::string_view message, OutputStreamName stream)
 {
-    // TODO: support LF -> CRLF option for newlines found in message.
-    auto handle = (stream == OutputStreamName::Stdout ? stdout : stderr);
+    if (stream == OutputStreamName::Stdout)
+    {
+        bufferOutput(message);
+        return;
+    }
+
+    // Standard error is not buffered, but anything already written to standard output must appear before it.
+    flushOutput();
 
-    if (fprintf(handle, "%.*s", (int)message.size(), message.data()) < 0)
+    if (fprintf(stderr, "%.*s", (int)message.size(), message.data()) < 0)
     {
         raiseError(errno, "Writing a string", __FILE__, __LINE__);
     }
@@ -163,25 +262,289 @@ void UnixConsole::write(std::string_view message, OutputStreamName stream)
 //---------------------------------------------------------------------------------------------------------------------
 char UnixConsole::read()
 {
-    // TODO: support CRLF -> LF option.
-    // Read a single (unbuffered) character from standard in.
+    // Make sure any prompt written by the program is visible before waiting for input.
+    flushOutput();
+
     char c = EOF;
 
-    if (::read(0, &c, 1) < 0)
+    if (!readInputByte(c))
     {
-        raiseError(errno, "Reading a character", __FILE__, __LINE__);
+        return EOF;
+    }
+
+    // Convert CR and CRLF to LF. The LF of a CRLF pair is dropped when it arrives rather than looked for ahead of
+    // time, because looking ahead would block on terminal input.
+    if (shouldConvertInputCRtoLF())
+    {
+        if (c == '\n' && wasLastInputCR_)
+        {
+            wasLastInputCR_ = false;
+
+            if (!readInputByte(c))
+            {
+                return EOF;
+            }
+        }
+
+        wasLastInputCR_ = (c == '\r');
+        c = (c == '\r' ? '\n' : c);
     }
 
     // Echo the character if requested.
     if (shouldEchoCharForInput())
     {
         write(c);
+        flushOutput();
     }
 
     // Return character.
     return c;
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+void UnixConsole::writeBlock(const char* data, size_t size)
+{
+    bufferOutput(std::string_view(data, size));
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+size_t UnixConsole::readBlock(char* buffer, size_t size)
+{
+    // Terminal input and input that needs converting or echoing is handled one byte at a time.
+    if (!isInputRedirected() || shouldConvertInputCRtoLF() || shouldEchoCharForInput())
+    {
+        return IConsole::readBlock(buffer, size);
+    }
+
+    flushOutput();
+
+    // Copy straight out of the input buffer, refilling it as it runs out.
+    size_t count = 0;
+
+    while (count < size)
+    {
+        if (inputBufferPosition_ == inputBufferEnd_)
+        {
+            char c = EOF;
+
+            if (!readInputByte(c))
+            {
+                break;
+            }
+
+            buffer[count++] = c;
+        }
+
+        auto available = std::min(size - count, inputBufferEnd_ - inputBufferPosition_);
+        std::memcpy(buffer + count, inputBuffer_.data() + inputBufferPosition_, available);
+
+        inputBufferPosition_ += available;
+        count += available;
+    }
+
+    return count;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+bool UnixConsole::readInputByte(char& c)
+{
+    if (!isInputRedirected())
+    {
+        auto status = ::read(STDIN_FILENO, &c, 1);
+
+        if (status < 0)
+        {
+            raiseError(errno, "Reading a character", __FILE__, __LINE__);
+        }
+
+        return status > 0;
+    }
+
+    // Refill the buffer from redirected input once every byte in it has been handed out.
+    if (inputBufferPosition_ == inputBufferEnd_)
+    {
+        inputBuffer_.resize(RedirectedInputBufferSize);
+        ssize_t status = 0;
+
+        do
+        {
+            status = ::read(STDIN_FILENO, inputBuffer_.data(), inputBuffer_.size());
+        } while (status < 0 && errno == EINTR);
+
+        if (status < 0)
+        {
+            raiseError(errno, "Reading input", __FILE__, __LINE__);
+        }
+
+        inputBufferPosition_ = 0;
+        inputBufferEnd_ = (status > 0 ? static_cast<size_t>(status) : 0);
+
+        if (inputBufferEnd_ == 0)
+        {
+            return false;
+        }
+    }
+
+    c = inputBuffer_[inputBufferPosition_++];
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void UnixConsole::bufferOutput(std::string_view text)
+{
+    std::lock_guard<std::mutex> lock(outputMutex_);
+    const bool wasEmpty = outputBuffer_.empty();
+
+    if (shouldConvertOutputLFtoCRLF())
+    {
+        // Copy the text over one line at a time, replacing each LF with CRLF.
+        for (auto newline = text.find('\n'); newline != std::string_view::npos; newline = text.find('\n'))
+        {
+            outputBuffer_.append(text.data(), newline);
+            outputBuffer_.append("\r\n");
+            text.remove_prefix(newline + 1);
+        }
+    }
+
+    outputBuffer_.append(text.data(), text.size());
+
+    if (outputBuffer_.size() >= outputBufferSize_)
+    {
+        flushOutputLocked();
+    }
+    else if (wasEmpty && outputFlushLatency_ > std::chrono::milliseconds::zero())
+    {
+        // Only the oldest byte in the buffer matters, so the clock is not read again until the buffer is flushed. The
+        // flush thread writes the buffer out once that byte has waited too long, even if nothing else is written.
+        oldestBufferedOutputTime_ = std::chrono::steady_clock::now();
+        wakeFlushThread(0);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void UnixConsole::wakeFlushThread(char reason) noexcept
+{
+    if (flushThreadPipe_[1] >= 0 && ::write(flushThreadPipe_[1], &reason, 1) < 0)
+    {
+        // The pipe is only full when the thread already has wake ups waiting for it.
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void UnixConsole::runFlushThread()
+{
+    for (;;)
+    {
+        // Wait for the oldest buffered byte to reach the flush latency, or until woken when there is no such byte.
+        int timeout = -1;
+
+        {
+            std::lock_guard<std::mutex> lock(outputMutex_);
+
+            if (isFlushThreadStopping_)
+            {
+                return;
+            }
+
+            if (!outputBuffer_.empty() && outputFlushLatency_ > std::chrono::milliseconds::zero())
+            {
+                auto waited = std::chrono::steady_clock::now() - oldestBufferedOutputTime_;
+
+                if (waited >= outputFlushLatency_)
+                {
+                    flushOutputLocked();
+                    continue;
+                }
+
+                timeout = static_cast<int>(
+                    std::chrono::ceil<std::chrono::milliseconds>(outputFlushLatency_ - waited).count());
+            }
+        }
+
+        pollfd wake = { flushThreadPipe_[0], POLLIN, 0 };
+
+        if (poll(&wake, 1, timeout) <= 0)
+        {
+            continue;
+        }
+
+        char reasons[16];
+        auto count = ::read(flushThreadPipe_[0], reasons, sizeof(reasons));
+
+        for (ssize_t i = 0; i < count; ++i)
+        {
+            if (reasons[i] == 0)
+            {
+                continue;
+            }
+
+            // A signal is stopping the process, so write what the program printed and then let the signal's original
+            // action run.
+            const int signal = reasons[i];
+
+            {
+                std::lock_guard<std::mutex> lock(outputMutex_);
+                flushOutputLocked();
+            }
+
+            sigaction(signal, signal == SIGINT ? &previousInterruptAction_ : &previousTerminateAction_, nullptr);
+            raise(signal);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void UnixConsole::flushOutput()
+{
+    std::lock_guard<std::mutex> lock(outputMutex_);
+    flushOutputLocked();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void UnixConsole::flushOutputLocked()
+{
+    if (outputBuffer_.empty())
+    {
+        return;
+    }
+
+    auto written = fwrite(outputBuffer_.data(), 1, outputBuffer_.size(), stdout);
+    auto isComplete = (written == outputBuffer_.size());
+    outputBuffer_.clear();
+
+    if (!isComplete || fflush(stdout) != 0)
+    {
+        raiseError(errno, "Writing buffered output", __FILE__, __LINE__);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void UnixConsole::setOutputBufferSize(size_t sizeInBytes)
+{
+    std::lock_guard<std::mutex> lock(outputMutex_);
+    outputBufferSize_ = sizeInBytes;
+
+    // Flush now if the buffer is already bigger than the new size.
+    if (outputBuffer_.size() >= outputBufferSize_)
+    {
+        flushOutputLocked();
+    }
+
+    outputBuffer_.reserve(outputBufferSize_);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+void UnixConsole::setOutputFlushLatency(std::chrono::milliseconds latency)
+{
+    {
+        std::lock_guard<std::mutex> lock(outputMutex_);
+        outputFlushLatency_ = latency;
+    }
+
+    // The flush thread may be waiting on the old latency.
+    wakeFlushThread(0);
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 bool UnixConsole::isInputRedirected() const
 {
@@ -287,6 +650,9 @@ void UnixConsole::printControlCode(const char* controlCode)
     // Only print the control code if there is a valid raw output or error stream.
     if (isRawOutput() || isRawError())
     {
+        // Keep the control code in order with any buffered output.
+        flushOutput();
+
         // Prefer printing to standard out unless it was disabled in which case print to stderr.
         auto handle = (isRawOutput() ? stdout : stderr);
         fprintf(handle, "%s", controlCode);
@@ -2,17 +2,42 @@
 #pragma once
 #include "../console.h"
 
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
 #include <unistd.h>
 #include <termios.h>
 
 namespace Brainfreeze::CommandLineApp
 {
-    /** Generic UNIX console implementation. */
+    /**
+     * Generic UNIX console implementation.
+     *
+     * Standard output is buffered, and a background thread writes the buffer once its oldest byte has waited for the
+     * flush latency, so output is not held back while the program computes. The thread also writes the buffer when
+     * the process is interrupted or terminated, before letting the signal end the process.
+     */
     class UnixConsole : public Console
     {
     public:
         using Console::write;
 
+        /** Default number of bytes buffered when standard output is a terminal. */
+        static constexpr size_t DefaultTerminalOutputBufferSize = 4096;
+
+        /** Default number of bytes buffered when standard output is redirected. */
+        static constexpr size_t DefaultRedirectedOutputBufferSize = 64 * 1024;
+
+        /** Default longest time buffered output waits when standard output is a terminal. */
+        static constexpr std::chrono::milliseconds DefaultTerminalFlushLatency{ 50 };
+
+        /** Number of bytes read at a time when standard input is redirected. */
+        static constexpr size_t RedirectedInputBufferSize = 64 * 1024;
+
         /** Default constructor. */
         UnixConsole();
 
@@ -25,9 +50,24 @@ namespace Brainfreeze::CommandLineApp
         /** Write a string to standard output. */
         virtual void write(std::string_view message, OutputStreamName stream) override;
 
-        /** Read a byte from the console. */
+        /** Read a byte from the console. Buffered output is written first so prompts are visible. */
         virtual char read() override;
 
+        /** Write a block of bytes to standard output. */
+        virtual void writeBlock(const char* data, size_t size) override;
+
+        /** Read up to `size` bytes from standard input, stopping early only at the end of input. */
+        virtual size_t readBlock(char* buffer, size_t size) override;
+
+        /** Write any buffered standard output to the console. */
+        virtual void flushOutput() override;
+
+        /** Set how many bytes of standard output can be buffered before they are written to the console. */
+        virtual void setOutputBufferSize(size_t sizeInBytes) override;
+
+        /** Set the longest time buffered standard output can wait before it is written to the console. */
+        virtual void setOutputFlushLatency(std::chrono::milliseconds latency) override;
+
         /** Check if input is redirected from the console. */
         virtual bool isInputRedirected() const override;
 
@@ -83,7 +123,39 @@ namespace Brainfreeze::CommandLineApp
         /** Raises an underlying system error and displays it to the user. */
         void raiseError(int error, const char* action, const char* filename, int lineNumber);
 
+        /**
+         * Read the next byte from standard input. Redirected input is read a block at a time, and terminal input a
+         * byte at a time so the program sees each key press as it happens. Returns false at the end of input.
+         */
+        bool readInputByte(char& c);
+
+        /** Add text to the standard output buffer and flush it if the buffer is full or has waited too long. */
+        void bufferOutput(std::string_view text);
+
+        /** Write any buffered standard output to the console. The output mutex must be held. */
+        void flushOutputLocked();
+
+        /** Wake the flush thread so it looks at the buffer again. Safe to call from a signal handler. */
+        void wakeFlushThread(char reason) noexcept;
+
+        /** Flush buffered output when it has waited too long, or when a signal arrives. */
+        void runFlushThread();
+
     private:
+        std::mutex outputMutex_;                ///< Guards the output buffer and its settings.
+        std::thread flushThread_;
+        int flushThreadPipe_[2] = { -1, -1 };   ///< Wakes the flush thread with a signal number, or zero.
+        bool isFlushThreadStopping_ = false;
+        struct sigaction previousInterruptAction_ = {};
+        struct sigaction previousTerminateAction_ = {};
+        std::string outputBuffer_;
+        size_t outputBufferSize_ = DefaultTerminalOutputBufferSize;
+        std::chrono::milliseconds outputFlushLatency_ = DefaultTerminalFlushLatency;
+        std::chrono::steady_clock::time_point oldestBufferedOutputTime_;
+        std::vector<char> inputBuffer_;
+        size_t inputBufferPosition_ = 0;
+        size_t inputBufferEnd_ = 0;
+        bool wasLastInputCR_ = false;
         termios oldTerminalParams_;
         bool didChangeTerminalParams = false;
         bool isInputRedirected_ = false;
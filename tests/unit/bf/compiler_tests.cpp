@@ -33,7 +33,10 @@ TEST_CASE("a program is always terminated with a end of stream instruction", "[c
 
     SECTION("when there are many instructions")
     {
-        auto il = Compile("[-]");
+        auto il = Compile("[-]", [](Compiler& c) {
+            c.setReplaceClearLoopsEnabled(false);
+            c.setReplaceMultiplyLoopsEnabled(false);
+        });
 
         REQUIRE(4 == il.size());
         REQUIRE(instruction_t(OpcodeType::EndOfStream) == il[3]);
@@ -42,7 +45,7 @@ TEST_CASE("a program is always terminated with a end of stream instruction", "[c
 
 TEST_CASE("the compiler ignores characters that are not brainfreeze instructions", "[compiler]")
 {
-    auto il = Compile("hello+ -world");
+    auto il = Compile("hello+ -world", [](Compiler& c) { c.setPassEnabled(CompilerPass::CancelRuns, false); });
 
     REQUIRE(3 == il.size());
     REQUIRE(instruction_t(OpcodeType::MemInc, 1) == il[0]);
@@ -111,7 +114,10 @@ TEST_CASE("> runs can be merged when the optimization flag is enabled", "[compil
 {
     SECTION("are not merged when there is only one instance")
     {
-        auto il = Compile(">+>", [](Compiler& c) { c.setMergeInstructionsEnabled(true); });
+        auto il = Compile(">+>", [](Compiler& c) {
+            c.setMergeInstructionsEnabled(true);
+            c.setOffsetAddressingEnabled(false);
+        });
         REQUIRE(4 == il.size());
         REQUIRE(instruction_t(OpcodeType::PtrInc, 1) == il[0]);
         REQUIRE(instruction_t(OpcodeType::MemInc, 1) == il[1]);
@@ -122,7 +128,10 @@ TEST_CASE("> runs can be merged when the optimization flag is enabled", "[compil
     SECTION("are merged when there are multiple instances")
     {
         //                 0 1234
-        auto il = Compile(">>,>.>>>", [](Compiler& c) { c.setMergeInstructionsEnabled(true); });
+        auto il = Compile(">>,>.>>>", [](Compiler& c) {
+            c.setMergeInstructionsEnabled(true);
+            c.setOffsetAddressingEnabled(false);
+        });
         REQUIRE(6 == il.size());
         REQUIRE(instruction_t(OpcodeType::PtrInc, 2) == il[0]);
         REQUIRE(instruction_t(OpcodeType::Read, 0) == il[1]);
@@ -134,7 +143,10 @@ TEST_CASE("> runs can be merged when the optimization flag is enabled", "[compil
 
     SECTION("are merged across ignored non-instruction characters")
     {
-        auto il = Compile("> >", [](Compiler& c) { c.setMergeInstructionsEnabled(true); });
+        auto il = Compile("> >", [](Compiler& c) {
+            c.setMergeInstructionsEnabled(true);
+            c.setOffsetAddressingEnabled(false);
+        });
         REQUIRE(2 == il.size());
         REQUIRE(instruction_t(OpcodeType::PtrInc, 2) == il[0]);
         REQUIRE(instruction_t(OpcodeType::EndOfStream, 0) == il[1]);
@@ -143,7 +155,10 @@ TEST_CASE("> runs can be merged when the optimization flag is enabled", "[compil
     SECTION("are not merged when the optimization is disabled")
     {
         //                 01234578
-        auto il = Compile(">>,>.>>>", [](Compiler& c) { c.setMergeInstructionsEnabled(false); });
+        auto il = Compile(">>,>.>>>", [](Compiler& c) {
+            c.setMergeInstructionsEnabled(false);
+            c.setOffsetAddressingEnabled(false);
+        });
         REQUIRE(9 == il.size());
         REQUIRE(instruction_t(OpcodeType::PtrInc, 1) == il[0]);
         REQUIRE(instruction_t(OpcodeType::PtrInc, 1) == il[1]);
@@ -161,7 +176,11 @@ TEST_CASE("< runs can be merged when the optimization flag is enabled", "[compil
 {
     SECTION("are not merged when there is only one instance")
     {
-        auto il = Compile("<+<", [](Compiler& c) { c.setMergeInstructionsEnabled(true); });
+        auto il = Compile("<+<", [](Compiler& c) {
+            c.setMergeInstructionsEnabled(true);
+            c.setOffsetAddressingEnabled(false);
+            c.setPassEnabled(CompilerPass::CancelRuns, false);
+        });
         REQUIRE(4 == il.size());
         REQUIRE(instruction_t(OpcodeType::PtrDec, 1) == il[0]);
         REQUIRE(instruction_t(OpcodeType::MemInc, 1) == il[1]);
@@ -172,7 +191,10 @@ TEST_CASE("< runs can be merged when the optimization flag is enabled", "[compil
     SECTION("are merged when there are multiple instances")
     {
         //                 0 1234
-        auto il = Compile("<<,<.<<<", [](Compiler& c) { c.setMergeInstructionsEnabled(true); });
+        auto il = Compile("<<,<.<<<", [](Compiler& c) {
+            c.setMergeInstructionsEnabled(true);
+            c.setOffsetAddressingEnabled(false);
+        });
         REQUIRE(6 == il.size());
         REQUIRE(instruction_t(OpcodeType::PtrDec, 2) == il[0]);
         REQUIRE(instruction_t(OpcodeType::Read, 0) == il[1]);
@@ -184,7 +206,10 @@ TEST_CASE("< runs can be merged when the optimization flag is enabled", "[compil
 
     SECTION("are merged across ignored non-instruction characters")
     {
-        auto il = Compile("< <", [](Compiler& c) { c.setMergeInstructionsEnabled(true); });
+        auto il = Compile("< <", [](Compiler& c) {
+            c.setMergeInstructionsEnabled(true);
+            c.setOffsetAddressingEnabled(false);
+        });
         REQUIRE(2 == il.size());
         REQUIRE(instruction_t(OpcodeType::PtrDec, 2) == il[0]);
         REQUIRE(instruction_t(OpcodeType::EndOfStream, 0) == il[1]);
@@ -193,7 +218,10 @@ TEST_CASE("< runs can be merged when the optimization flag is enabled", "[compil
     SECTION("are not merged when the optimization is disabled")
     {
         //                 01234578
-        auto il = Compile("<<,<.<<<", [](Compiler& c) { c.setMergeInstructionsEnabled(false); });
+        auto il = Compile("<<,<.<<<", [](Compiler& c) {
+            c.setMergeInstructionsEnabled(false);
+            c.setOffsetAddressingEnabled(false);
+        });
         REQUIRE(9 == il.size());
         REQUIRE(instruction_t(OpcodeType::PtrDec, 1) == il[0]);
         REQUIRE(instruction_t(OpcodeType::PtrDec, 1) == il[1]);
@@ -211,7 +239,10 @@ TEST_CASE("+ runs can be merged when the optimization flag is enabled", "[compil
 {
     SECTION("are not merged when there is only one instance")
     {
-        auto il = Compile("+-+", [](Compiler& c) { c.setMergeInstructionsEnabled(true); });
+        auto il = Compile("+-+", [](Compiler& c) {
+            c.setMergeInstructionsEnabled(true);
+            c.setPassEnabled(CompilerPass::CancelRuns, false);
+        });
         REQUIRE(4 == il.size());
         REQUIRE(instruction_t(OpcodeType::MemInc, 1) == il[0]);
         REQUIRE(instruction_t(OpcodeType::MemDec, 1) == il[1]);
@@ -261,7 +292,10 @@ TEST_CASE("- runs can be merged when the optimization flag is enabled", "[compil
 {
     SECTION("are not merged when there is only one instance")
     {
-        auto il = Compile("-+-", [](Compiler& c) { c.setMergeInstructionsEnabled(true); });
+        auto il = Compile("-+-", [](Compiler& c) {
+            c.setMergeInstructionsEnabled(true);
+            c.setPassEnabled(CompilerPass::CancelRuns, false);
+        });
         REQUIRE(4 == il.size());
         REQUIRE(instruction_t(OpcodeType::MemDec, 1) == il[0]);
         REQUIRE(instruction_t(OpcodeType::MemInc, 1) == il[1]);
@@ -310,7 +344,10 @@ TEST_CASE("- runs can be merged when the optimization flag is enabled", "[compil
 TEST_CASE("jump offsets are stored when the precalculate optimization is enabled", "[compiler]")
 {
     //                 012345678
-    auto il = Compile("[[.][]][]", [](Compiler& c) { c.setPrecalculateJumpOffsetsEnabled(true); });
+    auto il = Compile("[[.][]][]", [](Compiler& c) {
+        c.setPrecalculateJumpOffsetsEnabled(true);
+        c.setPassEnabled(CompilerPass::IfLoops, false);
+    });
 
     REQUIRE(instruction_t(OpcodeType::FastJumpForward, 6 - 0) == il[0]);
     REQUIRE(instruction_t(OpcodeType::FastJumpForward, 3 - 1) == il[1]);
@@ -345,3 +382,872 @@ TEST_CASE("unbalanced jump characters will throw an exception", "[compiler]")
         [&]() { Compile("[[[]]", [](Compiler& c) { c.setPrecalculateJumpOffsetsEnabled(false); }); }(),
         "Unbalanced jump, expected a ] before program termination");
 }
+
+TEST_CASE("clear loops are replaced with a set zero instruction", "[compiler]")
+{
+    SECTION("when the loop decrements")
+    {
+        auto il = Compile(">[-]<", [](Compiler& c) { c.setOffsetAddressingEnabled(false); });
+        REQUIRE(4 == il.size());
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 1) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::PtrDec, 1) == il[2]);
+    }
+
+    SECTION("when the loop increments")
+    {
+        auto il = Compile("[+]");
+        REQUIRE(2 == il.size());
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[0]);
+    }
+
+    SECTION("when the loop adjusts by an odd amount")
+    {
+        auto il = Compile("[---]");
+        REQUIRE(2 == il.size());
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[0]);
+    }
+
+    SECTION("when the loop is nested in another loop")
+    {
+        auto il = Compile("[>[-]<-]", [](Compiler& c) {
+            c.setOffsetAddressingEnabled(false);
+            c.setPassEnabled(CompilerPass::ClosedFormLoops, false);
+        });
+        REQUIRE(7 == il.size());
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 5) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::FastJumpBack, 5) == il[5]);
+    }
+
+    SECTION("unless the optimization is disabled")
+    {
+        auto il = Compile("[-]", [](Compiler& c) {
+            c.setReplaceClearLoopsEnabled(false);
+            c.setReplaceMultiplyLoopsEnabled(false);
+        });
+        REQUIRE(4 == il.size());
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 2) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::MemDec, 1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::FastJumpBack, 2) == il[2]);
+    }
+}
+
+TEST_CASE("loops that are not clear loops are not replaced", "[compiler]")
+{
+    SECTION("when the loop adjusts by an even amount")
+    {
+        auto il = Compile("[--]");
+        REQUIRE(4 == il.size());
+        REQUIRE(instruction_t(OpcodeType::MemDec, 2) == il[1]);
+    }
+
+    SECTION("when the loop has other instructions")
+    {
+        auto il = Compile("[-.]");
+        REQUIRE(5 == il.size());
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 3) == il[0]);
+    }
+}
+
+TEST_CASE("clear loops followed by an adjustment are replaced with a set value instruction", "[compiler]")
+{
+    SECTION("when followed by increments")
+    {
+        auto il = Compile("[-]+++.");
+        REQUIRE(3 == il.size());
+        REQUIRE(instruction_t(OpcodeType::SetValue, 3) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::Write) == il[1]);
+    }
+
+    SECTION("when followed by decrements")
+    {
+        auto il = Compile("[+]--");
+        REQUIRE(2 == il.size());
+        REQUIRE(instruction_t(OpcodeType::SetValue, -2) == il[0]);
+    }
+}
+
+TEST_CASE("multiply loops are replaced with multiply and add instructions", "[compiler]")
+{
+    SECTION("when the loop decrements")
+    {
+        auto il = Compile("[->+>+++<<]");
+        REQUIRE(5 == il.size());
+        REQUIRE(instruction_t(OpcodeType::CheckRangeIfNonZero, 2, 1) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::MulAdd, 1, 1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::MulAdd, 3, 2) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[3]);
+    }
+
+    SECTION("when the loop increments")
+    {
+        // The target is before the first cell, so it is checked when the loop would run.
+        auto il = Compile("[<-->+]");
+        REQUIRE(4 == il.size());
+        REQUIRE(instruction_t(OpcodeType::CheckRangeIfNonZero, -1, -1) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::MulAdd, 2, -1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[2]);
+    }
+
+    SECTION("when the adjustments to a cell cancel out")
+    {
+        auto il = Compile("[>+<->-<]");
+        REQUIRE(2 == il.size());
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[0]);
+    }
+
+    SECTION("when the loop is nested in another loop")
+    {
+        auto il = Compile("+[>[->+<]<-]", [](Compiler& c) { c.setPassEnabled(CompilerPass::ClosedFormLoops, false); });
+        REQUIRE(10 == il.size());
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 7) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::CheckRangeIfNonZero, 1, 1) == il[3]);
+        REQUIRE(instruction_t(OpcodeType::MulAdd, 1, 1) == il[4]);
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[5]);
+        REQUIRE(instruction_t(OpcodeType::FastJumpBack, 7) == il[8]);
+    }
+
+    SECTION("unless the optimization is disabled")
+    {
+        auto il = Compile("[->+<]", [](Compiler& c) {
+            c.setReplaceMultiplyLoopsEnabled(false);
+            c.setOffsetAddressingEnabled(false);
+        });
+        REQUIRE(7 == il.size());
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 5) == il[0]);
+    }
+}
+
+TEST_CASE("loops that are not multiply loops are not replaced", "[compiler]")
+{
+    SECTION("when the pointer does not return to the loop cell")
+    {
+        auto il = Compile("[->+]");
+        REQUIRE(7 == il.size());
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 5) == il[0]);
+    }
+
+    SECTION("when the loop cell changes by more than one")
+    {
+        auto il = Compile("[-->+<]", [](Compiler& c) { c.setOffsetAddressingEnabled(false); });
+        REQUIRE(7 == il.size());
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 5) == il[0]);
+    }
+
+    SECTION("when the loop has other instructions")
+    {
+        auto il = Compile("[->.<]", [](Compiler& c) { c.setOffsetAddressingEnabled(false); });
+        REQUIRE(7 == il.size());
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 5) == il[0]);
+    }
+
+    SECTION("when the loop contains another loop")
+    {
+        auto il = Compile("[->[-]<]", [](Compiler& c) {
+            c.setOffsetAddressingEnabled(false);
+            c.setPassEnabled(CompilerPass::ClosedFormLoops, false);
+        });
+        REQUIRE(7 == il.size());
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 5) == il[0]);
+    }
+
+    SECTION("when a target cell is too far away to be addressed")
+    {
+        auto il = Compile("[-" + std::string(200, '>') + "+" + std::string(200, '<') + "]");
+        REQUIRE(7 == il.size());
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 5) == il[0]);
+    }
+}
+
+TEST_CASE("scan loops are replaced with scan instructions", "[compiler]")
+{
+    SECTION("when the loop moves right")
+    {
+        auto il = Compile("+[>>>]");
+        REQUIRE(3 == il.size());
+        REQUIRE(instruction_t(OpcodeType::ScanRight, 3) == il[1]);
+    }
+
+    SECTION("when the loop moves left")
+    {
+        auto il = Compile("[<]");
+        REQUIRE(2 == il.size());
+        REQUIRE(instruction_t(OpcodeType::ScanLeft, 1) == il[0]);
+    }
+
+    SECTION("unless the optimization is disabled")
+    {
+        auto il = Compile("[>]", [](Compiler& c) { c.setReplaceScanLoopsEnabled(false); });
+        REQUIRE(4 == il.size());
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 1) == il[1]);
+    }
+}
+
+TEST_CASE("memory accesses within a block are addressed with offsets", "[compiler]")
+{
+    SECTION("when the block returns to where it started")
+    {
+        auto il = Compile(">>+<<-");
+        REQUIRE(4 == il.size());
+        REQUIRE(instruction_t(OpcodeType::CheckRange, 2, 2) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1, 2) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::MemDec, 1, 0) == il[2]);
+    }
+
+    SECTION("when the block moves the pointer")
+    {
+        auto il = Compile(">.<<,>>>");
+        REQUIRE(4 == il.size());
+        REQUIRE(instruction_t(OpcodeType::Write, 0, 1) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::Read, 0, -1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 2) == il[2]);
+    }
+
+    SECTION("when the pointer moves before a loop")
+    {
+        auto il = Compile(">+<<[>-<]");
+        REQUIRE(8 == il.size());
+        REQUIRE(instruction_t(OpcodeType::CheckRange, 1, 1) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1, 1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::PtrDec, 1) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 3) == il[3]);
+        REQUIRE(instruction_t(OpcodeType::CheckRange, 1, 1) == il[4]);
+        REQUIRE(instruction_t(OpcodeType::MemDec, 1, 1) == il[5]);
+        REQUIRE(instruction_t(OpcodeType::FastJumpBack, 3) == il[6]);
+    }
+
+    SECTION("when an offset is too large to encode")
+    {
+        auto il = Compile(std::string(200, '>') + "+");
+        REQUIRE(3 == il.size());
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 200) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1, 0) == il[1]);
+    }
+
+    SECTION("unless the optimization is disabled")
+    {
+        auto il = Compile(">+<", [](Compiler& c) { c.setOffsetAddressingEnabled(false); });
+        REQUIRE(4 == il.size());
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1) == il[1]);
+    }
+}
+
+TEST_CASE("runs too long for one instruction are split across instructions", "[compiler]")
+{
+    // Cell changes wrap around when runs are cancelled so only merging alone leaves a long run of +.
+    auto il = Compile(std::string(40000, '+'), [](Compiler& c) { c.setPassEnabled(CompilerPass::CancelRuns, false); });
+    REQUIRE(3 == il.size());
+    REQUIRE(instruction_t(OpcodeType::MemInc, 32767) == il[0]);
+    REQUIRE(instruction_t(OpcodeType::MemInc, 40000 - 32767) == il[1]);
+
+    SECTION("pointer moves do not wrap around when cancelled")
+    {
+        auto moves = Compile(std::string(40000, '>'));
+        REQUIRE(3 == moves.size());
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 32767) == moves[0]);
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 40000 - 32767) == moves[1]);
+    }
+}
+
+TEST_CASE("runs of opposing instructions are cancelled to their net change", "[compiler]")
+{
+    SECTION("cell changes")
+    {
+        auto il = Compile("+++--");
+        REQUIRE(2 == il.size());
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1) == il[0]);
+    }
+
+    SECTION("cell changes wrap around")
+    {
+        auto il = Compile(std::string(200, '+'));
+        REQUIRE(2 == il.size());
+        REQUIRE(instruction_t(OpcodeType::MemDec, 56) == il[0]);
+    }
+
+    SECTION("cell changes do not wrap around when compiling for wider cells")
+    {
+        auto il = Compile(std::string(200, '+') + std::string(40000, '+'), [](Compiler& c) { c.setCellSize(2); });
+        REQUIRE(3 == il.size());
+        REQUIRE(instruction_t(OpcodeType::MemInc, 32767) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::MemInc, 7433) == il[1]);
+    }
+
+    SECTION("pointer moves")
+    {
+        auto il = Compile(">>,><<<.", [](Compiler& c) { c.setOffsetAddressingEnabled(false); });
+        REQUIRE(5 == il.size());
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 2) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::Read, 0) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::PtrDec, 2) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::Write, 0) == il[3]);
+    }
+
+    SECTION("runs with no net change are removed")
+    {
+        auto il = Compile("," + std::string(256, '+') + "<><>-+.");
+        REQUIRE(3 == il.size());
+        REQUIRE(instruction_t(OpcodeType::Read, 0) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::Write, 0) == il[1]);
+    }
+
+    SECTION("unless the pass is disabled")
+    {
+        auto il = Compile("+-", [](Compiler& c) { c.setPassEnabled(CompilerPass::CancelRuns, false); });
+        REQUIRE(3 == il.size());
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::MemDec, 1) == il[1]);
+    }
+}
+
+TEST_CASE("loops that start on a cell known to be zero are removed", "[compiler]")
+{
+    auto enableDeadLoops = [](Compiler& c) {
+        c.setOptimizationLevel(1);
+        c.setPassEnabled(CompilerPass::DeadLoops, true);
+        c.setPrecalculateJumpOffsetsEnabled(false);
+    };
+
+    SECTION("comment loops at the start of a program")
+    {
+        auto il = Compile("[comment, with [nested] loops.]>>[more]+", enableDeadLoops);
+        REQUIRE(3 == il.size());
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 2) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1) == il[1]);
+    }
+
+    SECTION("loops right after another loop")
+    {
+        auto il = Compile(",[>][<][.],", enableDeadLoops);
+        REQUIRE(6 == il.size());
+        REQUIRE(instruction_t(OpcodeType::Read, 0) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::JumpForward) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 1) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::JumpBack) == il[3]);
+        REQUIRE(instruction_t(OpcodeType::Read, 0) == il[4]);
+    }
+
+    SECTION("but not after the cell or pointer may have changed")
+    {
+        auto il = Compile(",[-]>[.]<[-]-[.]", enableDeadLoops);
+        REQUIRE(17 == il.size());
+    }
+
+    SECTION("unless the pass is disabled")
+    {
+        auto il = Compile("[.]", [](Compiler& c) { c.setPrecalculateJumpOffsetsEnabled(false); });
+        REQUIRE(4 == il.size());
+        REQUIRE(instruction_t(OpcodeType::JumpForward) == il[0]);
+    }
+
+    SECTION("is enabled at optimization level one")
+    {
+        REQUIRE(1 == Compiler::passOptimizationLevel(CompilerPass::DeadLoops));
+        REQUIRE(CompilerPass::DeadLoops == Compiler::findPass("dead-loops"));
+    }
+}
+
+TEST_CASE("counted loops of multiply loops are replaced with closed form arithmetic", "[compiler]")
+{
+    auto unlinked = [](Compiler& c) { c.setPrecalculateJumpOffsetsEnabled(false); };
+
+    SECTION("with cells set to a constant applied once")
+    {
+        auto il = Compile("[->[-]>++<<]", unlinked);
+        REQUIRE(8 == il.size());
+        REQUIRE(instruction_t(OpcodeType::IfZeroSkip) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::CheckRange, 1, 1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::CheckRangeIfNonZero, 2, 2) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::MulAdd, 2, 2) == il[3]);
+        REQUIRE(instruction_t(OpcodeType::SetZero, 0, 1) == il[4]);
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[5]);
+        REQUIRE(instruction_t(OpcodeType::EndIf) == il[6]);
+    }
+
+    SECTION("when the loop counts up")
+    {
+        auto il = Compile("[+>+>[-]<<]", unlinked);
+        REQUIRE(instruction_t(OpcodeType::MulAdd, -1, 1) == il[2]);
+    }
+
+    SECTION("with products of the loop cell and unchanged cells")
+    {
+        // The first iteration moves t back into b so it is run as is, and after that b is unchanged.
+        //                 0    1 2    3 4    5   6   7   8 9    10
+        auto il = Compile("[->[->+>+<<]>>[-<<+>>]<<<]", unlinked);
+        // The pointer has already moved over the cells the product touches, so it needs no check of its own.
+        REQUIRE(16 == il.size());
+        REQUIRE(instruction_t(OpcodeType::IfZeroSkip) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::MemDec, 1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::CheckRangeIfNonZero, 2, 1) == il[3]);
+        REQUIRE(instruction_t(OpcodeType::PtrDec, 3) == il[10]);
+        REQUIRE(instruction_t(OpcodeType::ProductAdd, 1, 2) == il[11]);
+        REQUIRE(instruction_t(OpcodeType::NoOperation, 0, 1) == il[12]);
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[13]);
+        REQUIRE(instruction_t(OpcodeType::EndIf) == il[14]);
+    }
+
+    SECTION("but not when a cell changes in some other way each iteration")
+    {
+        // Each iteration flips the second cell between x and 1 - x.
+        auto il = Compile("[->[->+<]>[-<->]<+<]", unlinked);
+        REQUIRE(instruction_t(OpcodeType::JumpForward) == il[0]);
+    }
+
+    SECTION("unless the pass is disabled")
+    {
+        auto il = Compile("[->[-]>++<<]", [](Compiler& c) {
+            c.setPrecalculateJumpOffsetsEnabled(false);
+            c.setPassEnabled(CompilerPass::ClosedFormLoops, false);
+        });
+        REQUIRE(instruction_t(OpcodeType::JumpForward) == il[0]);
+    }
+}
+
+TEST_CASE("loops that run at most once become an IfZeroSkip and EndIf", "[compiler]")
+{
+    SECTION("when the body ends by clearing the loop cell")
+    {
+        auto il = Compile("[>+<[-]]", [](Compiler& c) { c.setPrecalculateJumpOffsetsEnabled(false); });
+        REQUIRE(6 == il.size());
+        REQUIRE(instruction_t(OpcodeType::IfZeroSkip) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::CheckRange, 1, 1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1, 1) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[3]);
+        REQUIRE(instruction_t(OpcodeType::EndIf) == il[4]);
+    }
+
+    SECTION("when a nested loop on the loop cell ends the body")
+    {
+        auto il = Compile("[>+<[>]<[.]]", [](Compiler& c) { c.setPrecalculateJumpOffsetsEnabled(false); });
+        REQUIRE(instruction_t(OpcodeType::JumpForward) == il[0]);
+
+        il = Compile("[>+<[.]]", [](Compiler& c) { c.setPrecalculateJumpOffsetsEnabled(false); });
+        REQUIRE(instruction_t(OpcodeType::IfZeroSkip) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::JumpForward) == il[3]);
+        REQUIRE(instruction_t(OpcodeType::EndIf) == il[6]);
+    }
+
+    SECTION("with the distance to the EndIf when jumps are linked")
+    {
+        auto il = Compile("[>+<[-]]");
+        REQUIRE(instruction_t(OpcodeType::IfZeroSkip, 4) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::EndIf) == il[4]);
+    }
+
+    SECTION("that tests a cell at an offset and restores the pointer at the EndIf")
+    {
+        //                 0  1 2    3   4 5  6
+        auto il = Compile(">>[>[-<+>]<[-]]");
+        REQUIRE(10 == il.size());
+        REQUIRE(instruction_t(OpcodeType::CheckRange, 2, 2) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::IfZeroSkip, 6, 2) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 3) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::MulAdd, 1, -1) == il[3]);
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[4]);
+        REQUIRE(instruction_t(OpcodeType::SetZero, 0, -1) == il[5]);
+        REQUIRE(instruction_t(OpcodeType::PtrDec, 3) == il[6]);
+        REQUIRE(instruction_t(OpcodeType::EndIf) == il[7]);
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 2) == il[8]);
+    }
+
+    SECTION("but not when the loop cell may be non-zero at the end of the body")
+    {
+        auto firstOf = [](const std::string& code) {
+            return Compile(code, [](Compiler& c) { c.setPrecalculateJumpOffsetsEnabled(false); })[0];
+        };
+
+        REQUIRE(instruction_t(OpcodeType::JumpForward) == firstOf("[[-]>+<-.]"));
+        REQUIRE(instruction_t(OpcodeType::JumpForward) == firstOf("[>[-]<.]"));
+        REQUIRE(instruction_t(OpcodeType::JumpForward) == firstOf("[[-]>]"));
+        REQUIRE(instruction_t(OpcodeType::JumpForward) == firstOf("[<[-]>[>]<]"));
+    }
+
+    SECTION("unless the pass is disabled")
+    {
+        auto il = Compile("[>+<[-]]", [](Compiler& c) { c.setPassEnabled(CompilerPass::IfLoops, false); });
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 4) == il[0]);
+    }
+}
+
+TEST_CASE("cell values known at compile time are propagated", "[compiler]")
+{
+    auto enableConstantPropagation = [](Compiler& c) {
+        c.setPassEnabled(CompilerPass::ConstantPropagation, true);
+        c.setPassEnabled(CompilerPass::FoldConstantOutput, false);
+        c.setPrecalculateJumpOffsetsEnabled(false);
+    };
+
+    SECTION("by replacing adds on known cells with stores")
+    {
+        auto il = Compile("+++>++", enableConstantPropagation);
+        REQUIRE(5 == il.size());
+        REQUIRE(instruction_t(OpcodeType::SetValue, 3) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::SetValue, 2, 1) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 1) == il[3]);
+    }
+
+    SECTION("by replacing multiplies by a known cell with stores")
+    {
+        auto il = Compile("+++[->++<]", enableConstantPropagation);
+        REQUIRE(5 == il.size());
+        REQUIRE(instruction_t(OpcodeType::SetValue, 3) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::SetValue, 6, 1) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[3]);
+    }
+
+    SECTION("by removing stores of the value a cell already has")
+    {
+        auto il = Compile(",[-][-]>[-]", enableConstantPropagation);
+        REQUIRE(4 == il.size());
+        REQUIRE(instruction_t(OpcodeType::Read) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 1) == il[2]);
+    }
+
+    SECTION("past loops for cells the loop does not change")
+    {
+        //                 0 1   2 3  4 5   6 7 8
+        auto il = Compile(",[>+<,]>+>+<<+", enableConstantPropagation);
+        REQUIRE(11 == il.size());
+        REQUIRE(instruction_t(OpcodeType::JumpBack) == il[5]);
+        REQUIRE(instruction_t(OpcodeType::CheckRange, 2, 1) == il[6]);
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1, 1) == il[7]);
+        REQUIRE(instruction_t(OpcodeType::SetValue, 1, 2) == il[8]);
+        REQUIRE(instruction_t(OpcodeType::SetValue, 1) == il[9]);
+    }
+
+    SECTION("but not past loops that move the pointer")
+    {
+        auto il = Compile(",[>,]>+", enableConstantPropagation);
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1, 1) == il[6]);
+    }
+
+    SECTION("by removing loops and skips on a cell known to be zero")
+    {
+        auto il = Compile(">[>+<[-]]<[.>]", enableConstantPropagation);
+        REQUIRE(1 == il.size());
+        REQUIRE(instruction_t(OpcodeType::EndOfStream) == il[0]);
+    }
+
+    SECTION("by always running skips on a cell known to be non-zero")
+    {
+        auto il = Compile("+[>+<[-]]", enableConstantPropagation);
+        REQUIRE(5 == il.size());
+        REQUIRE(instruction_t(OpcodeType::SetValue, 1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::SetValue, 1, 1) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[3]);
+    }
+
+    SECTION("by joining what is known whether or not a skip runs")
+    {
+        auto il = Compile(",[>+<[-]]+>+", enableConstantPropagation);
+        REQUIRE(11 == il.size());
+        REQUIRE(instruction_t(OpcodeType::IfZeroSkip) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::SetValue, 1, 1) == il[3]);
+        REQUIRE(instruction_t(OpcodeType::EndIf) == il[5]);
+        REQUIRE(instruction_t(OpcodeType::SetValue, 1) == il[7]);
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1, 1) == il[8]);
+    }
+
+    SECTION("is enabled at optimization level two")
+    {
+        REQUIRE(2 == Compiler::passOptimizationLevel(CompilerPass::ConstantPropagation));
+        REQUIRE(CompilerPass::ConstantPropagation == Compiler::findPass("const-prop"));
+    }
+}
+
+TEST_CASE("jumps too far apart for the instruction parameter become far jumps", "[compiler]")
+{
+    // Alternating + and - are not merged when cancelling runs is disabled so the loop body has 40000 instructions.
+    // The outer loop of the nested case only runs once, so keep it a loop rather than an IfZeroSkip.
+    std::string body;
+
+    for (int i = 0; i < 20000; ++i)
+    {
+        body += "+-";
+    }
+
+    auto keepLoops = [](Compiler& c) {
+        c.setPassEnabled(CompilerPass::CancelRuns, false);
+        c.setPassEnabled(CompilerPass::IfLoops, false);
+    };
+
+    SECTION("far jumps store their distance in an extension word")
+    {
+        auto il = Compile("+[" + body + "]", keepLoops);
+        REQUIRE(40006 == il.size());
+        REQUIRE(instruction_t(OpcodeType::FarJumpForward) == il[1]);
+        REQUIRE(40002 == il[2].extensionValue());
+        REQUIRE(instruction_t(OpcodeType::FarJumpBack) == il[40003]);
+        REQUIRE(40002 == il[40004].extensionValue());
+    }
+
+    SECTION("jumps nested in a far jump stay near")
+    {
+        auto il = Compile("+[" + body + "[--]]", keepLoops);
+        REQUIRE(instruction_t(OpcodeType::FarJumpForward) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 2) == il[40003]);
+        REQUIRE(instruction_t(OpcodeType::FastJumpBack, 2) == il[40005]);
+        REQUIRE(instruction_t(OpcodeType::FarJumpBack) == il[40006]);
+        REQUIRE(40005 == il[40007].extensionValue());
+    }
+
+    SECTION("far IfZeroSkip stores its distance to the EndIf in an extension word")
+    {
+        auto il = Compile(",[" + body + "[-]]", [](Compiler& c) { c.setPassEnabled(CompilerPass::CancelRuns, false); });
+        REQUIRE(40006 == il.size());
+        REQUIRE(instruction_t(OpcodeType::FarIfZeroSkip) == il[1]);
+        REQUIRE(instruction_t::extension(40003) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[40003]);
+        REQUIRE(instruction_t(OpcodeType::EndIf) == il[40004]);
+    }
+}
+
+TEST_CASE("far jumps hold distances longer than an extension word", "[compiler]")
+{
+    std::string body(instruction_t::MaxExtensionValue + 9, '\0');
+
+    for (size_t i = 0; i < body.size(); i += 2)
+    {
+        body[i] = '+';
+        body[i + 1] = '-';
+    }
+
+    auto il = Compile("+[" + body + "]", [](Compiler& c) {
+        c.setOptimizationLevel(0);
+        c.setPrecalculateJumpOffsetsEnabled(true);
+    });
+
+    const auto distance = body.size() + 2;
+    REQUIRE(distance > instruction_t::MaxExtensionValue);
+    REQUIRE(OpcodeType::FarJumpForward == il[1].opcode());
+    REQUIRE(distance == il[1].farDistance(il[2]));
+    REQUIRE(OpcodeType::FarJumpBack == il[distance + 1].opcode());
+    REQUIRE(distance == il[distance + 1].farDistance(il[distance + 2]));
+}
+
+TEST_CASE("writes of cells with known values are folded into a print string", "[compiler]")
+{
+    SECTION("when the writes are in straight line code")
+    {
+        auto il = Compile("++.+.");
+        REQUIRE(5 == il.size());
+        REQUIRE(instruction_t(OpcodeType::MemInc, 2) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::PrintString, 2) == il[1]);
+        REQUIRE(instruction_t::stringData("\x02\x03", 2) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1) == il[3]);
+    }
+
+    SECTION("when the text needs several data words")
+    {
+        auto il = Compile("+.+.+.+.");
+        REQUIRE(instruction_t(OpcodeType::PrintString, 4) == il[1]);
+        REQUIRE(instruction_t::stringData("\x01\x02\x03", 3) == il[2]);
+        REQUIRE(instruction_t::stringData("\x04", 1) == il[3]);
+    }
+
+    SECTION("when only the loop cell is known after a loop")
+    {
+        auto il = Compile("+>,<[-]..>.");
+        REQUIRE(instruction_t(OpcodeType::SetZero) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::PrintString, 2) == il[3]);
+        REQUIRE(instruction_t::stringData("\0\0", 2) == il[4]);
+        REQUIRE(instruction_t(OpcodeType::Write, 0, 1) == il[5]);
+    }
+
+    SECTION("when a loop is never entered")
+    {
+        auto il = Compile("[.]++..");
+        REQUIRE(instruction_t(OpcodeType::PrintString, 2) == il[4]);
+    }
+
+    SECTION("unless a write of an unknown cell is between them")
+    {
+        auto il = Compile(">,<+.>.<.");
+        REQUIRE(instruction_t(OpcodeType::Write, 0, 0) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::Write, 0, 1) == il[3]);
+        REQUIRE(instruction_t(OpcodeType::Write, 0, 0) == il[4]);
+    }
+
+    SECTION("unless the optimization is disabled")
+    {
+        auto il = Compile("++.+.", [](Compiler& c) { c.setFoldConstantOutputEnabled(false); });
+        REQUIRE(instruction_t(OpcodeType::Write) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::Write) == il[3]);
+    }
+}
+
+TEST_CASE("the start of a program that reads no input is run at compile time", "[compiler]")
+{
+    auto enable = [](size_t budget) {
+        return [budget](Compiler& c) {
+            c.setPartialEvaluationEnabled(true);
+            c.setPartialEvaluationBudget(budget);
+        };
+    };
+
+    SECTION("when the whole program reads no input")
+    {
+        auto il = Compile("++++++++[>++++++++<-]>+.+.", enable(1000));
+        REQUIRE(6 == il.size());
+        REQUIRE(instruction_t(OpcodeType::CheckRange, 1, 1) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::SetValue, 66, 1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::PtrInc, 1) == il[2]);
+        REQUIRE(instruction_t(OpcodeType::PrintString, 2) == il[3]);
+        REQUIRE(instruction_t::stringData("AB", 2) == il[4]);
+    }
+
+    SECTION("when the program reads input")
+    {
+        auto il = Compile("+++>,<.", enable(1000));
+        REQUIRE(4 == il.size());
+        REQUIRE(instruction_t(OpcodeType::SetValue, 3) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::Read, 0, 1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::Write) == il[2]);
+    }
+
+    SECTION("when the program reads input inside a loop")
+    {
+        auto il = Compile("++[>,<-]", enable(1000));
+        REQUIRE(6 == il.size());
+        REQUIRE(instruction_t(OpcodeType::SetValue, 2) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 3) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::Read, 0, 1) == il[2]);
+    }
+
+    SECTION("when the program runs out of budget")
+    {
+        auto il = Compile("+>+>+.", enable(1));
+        REQUIRE(7 == il.size());
+        REQUIRE(instruction_t(OpcodeType::SetValue, 1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1, 1) == il[2]);
+    }
+
+    SECTION("when the program moves past the end of memory")
+    {
+        auto il = Compile("+[>+]", enable(1000000));
+        REQUIRE(instruction_t(OpcodeType::SetValue, 1) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 4) == il[1]);
+    }
+
+    SECTION("on a tape with the number of cells the program is compiled for")
+    {
+        auto il = Compile("+>>>>+.", [&enable](Compiler& c) {
+            enable(1000)(c);
+            c.setCellCount(4);
+        });
+        // Cell 4 is past the end of memory, so it is checked when the program runs.
+        REQUIRE(instruction_t(OpcodeType::CheckRange, 4, 4) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::SetValue, 1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1, 4) == il[2]);
+
+        REQUIRE_THROWS(Compiler().setCellCount(0));
+    }
+
+    SECTION("unless the optimization is disabled")
+    {
+        auto il = Compile("+.");
+        REQUIRE(3 == il.size());
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1) == il[0]);
+    }
+}
+
+TEST_CASE("optimization levels choose which passes run", "[compiler]")
+{
+    SECTION("level zero runs no passes")
+    {
+        auto il = Compile("++[-]", [](Compiler& c) { c.setOptimizationLevel(0); });
+        REQUIRE(6 == il.size());
+        REQUIRE(instruction_t(OpcodeType::MemInc, 1) == il[1]);
+        REQUIRE(instruction_t(OpcodeType::JumpForward) == il[2]);
+    }
+
+    SECTION("level one merges runs and links jumps")
+    {
+        auto il = Compile("++[-]", [](Compiler& c) { c.setOptimizationLevel(1); });
+        REQUIRE(5 == il.size());
+        REQUIRE(instruction_t(OpcodeType::MemInc, 2) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::FastJumpForward, 2) == il[1]);
+    }
+
+    SECTION("level three enables every pass")
+    {
+        Compiler compiler;
+        compiler.setOptimizationLevel(3);
+
+        for (size_t i = 0; i < CompilerPassCount; ++i)
+        {
+            REQUIRE(compiler.isPassEnabled(static_cast<CompilerPass>(i)));
+        }
+    }
+
+    SECTION("passes can be changed after choosing a level")
+    {
+        auto il = Compile("++[-]", [](Compiler& c) {
+            c.setOptimizationLevel(0);
+            c.setPassEnabled(CompilerPass::MergeRuns, true);
+        });
+        REQUIRE(5 == il.size());
+        REQUIRE(instruction_t(OpcodeType::MemInc, 2) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::JumpForward) == il[1]);
+    }
+
+    SECTION("levels out of range are rejected")
+    {
+        Compiler compiler;
+        REQUIRE_THROWS(compiler.setOptimizationLevel(-1));
+        REQUIRE_THROWS(compiler.setOptimizationLevel(4));
+    }
+}
+
+TEST_CASE("passes that assume one byte cells are skipped when compiling for wider cells", "[compiler]")
+{
+    auto compileWithCellSize = [](size_t cellSize) {
+        return Compile("+++.", [cellSize](Compiler& c) {
+            c.setOptimizationLevel(3);
+            c.setCellSize(cellSize);
+        });
+    };
+
+    SECTION("for one byte cells the program runs at compile time")
+    {
+        auto il = compileWithCellSize(1);
+        REQUIRE(instruction_t(OpcodeType::SetValue, 3) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::PrintString, 1) == il[1]);
+    }
+
+    SECTION("for wider cells it does not")
+    {
+        auto il = compileWithCellSize(2);
+        REQUIRE(3 == il.size());
+        REQUIRE(instruction_t(OpcodeType::MemInc, 3) == il[0]);
+        REQUIRE(instruction_t(OpcodeType::Write) == il[1]);
+    }
+
+    SECTION("which passes are skipped")
+    {
+        REQUIRE(Compiler::passNeedsByteCells(CompilerPass::ConstantPropagation));
+        REQUIRE_FALSE(Compiler::passNeedsByteCells(CompilerPass::MultiplyLoops));
+    }
+
+    SECTION("cell sizes other than 1, 2, 4 or 8 are rejected")
+    {
+        Compiler compiler;
+        REQUIRE_THROWS(compiler.setCellSize(3));
+        REQUIRE(1 == compiler.cellSize());
+    }
+}
+
+TEST_CASE("compiler passes can be found by name", "[compiler]")
+{
+    for (size_t i = 0; i < CompilerPassCount; ++i)
+    {
+        auto pass = static_cast<CompilerPass>(i);
+        REQUIRE(pass == Compiler::findPass(Compiler::passName(pass)));
+    }
+
+    REQUIRE(CompilerPass::ScanLoops == Compiler::findPass("scan-loops"));
+    REQUIRE_FALSE(Compiler::findPass("not-a-pass").has_value());
+}
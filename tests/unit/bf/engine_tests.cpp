@@ -0,0 +1,913 @@
+#include "bf/bf.h"
+#include "testhelpers.h"
+#include <catch2/catch.hpp>
+
+#include <thread>
+#include <vector>
+
+using namespace Brainfreeze;
+using namespace Brainfreeze::TestHelpers;
+
+namespace
+{
+    /** Run a program with the requested engine, feeding it input and returning everything it wrote. */
+    std::string RunWithEngine(
+        Interpreter& app,
+        Interpreter::ExecutionEngine engine,
+        std::string input = "")
+    {
+        std::string output;
+
+        app.setConsole(std::make_unique<TestableConsole>(
+            [&input]() {
+                if (input.empty())
+                {
+                    return (char)0;
+                }
+
+                auto c = input.front();
+                input.erase(input.begin());
+                return c;
+            },
+            [&output](char c) { output.append(1, c); }));
+
+        app.setExecutionEngine(engine);
+        app.run();
+
+        return output;
+    }
+}
+
+TEST_CASE("execution engine can only be changed before running", "[engines]")
+{
+    auto app = CreateInterpreter("+");
+    app.setExecutionEngine(Interpreter::ExecutionEngine::Threaded);
+    REQUIRE(Interpreter::ExecutionEngine::Threaded == app.executionEngine());
+
+    app.run();
+    REQUIRE_THROWS(app.setExecutionEngine(Interpreter::ExecutionEngine::Basic));
+}
+
+TEST_CASE("execution engines match the basic engine", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+
+    SECTION("empty program")
+    {
+        auto app = CreateInterpreter("");
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app.instructionPointer(), InstructionPointerIs(0));
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(0));
+    }
+
+    SECTION("pointer and memory arithmetic")
+    {
+        auto app = CreateInterpreter("+++>++>>-<<<--");
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app.instructionPointer(), InstructionPointerIs(5));
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(0));
+        REQUIRE_THAT(app, HasMemory(0, 1));
+        REQUIRE_THAT(app, HasMemory(1, 2));
+        REQUIRE_THAT(app, HasMemory(3, -1));
+    }
+
+    SECTION("hello world")
+    {
+        auto app = CreateInterpreter(
+            "++++++++++[>+++++++>++++++++++>+++>+<<<<-]>++.>+.+++++++..+++.>++.<<+++++++++++++++.>.+++.------.--------."
+            ">+.>.");
+
+        REQUIRE("Hello World!\n" == RunWithEngine(app, engine));
+    }
+
+    SECTION("echo")
+    {
+        auto app = CreateInterpreter(",[.,]");
+        REQUIRE("testing 123" == RunWithEngine(app, engine, "testing 123"));
+    }
+
+    SECTION("input and output away from the memory pointer")
+    {
+        auto app = CreateInterpreter(">,>,<<++[>>.<.<-]>>>");
+        REQUIRE("baba" == RunWithEngine(app, engine, "ab"));
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(3));
+    }
+
+    SECTION("nested loops")
+    {
+        auto app = CreateInterpreter("++++++++[>++++[>++>+++<<-]<-]>>");
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(2));
+        REQUIRE_THAT(app, HasMemory(0, 0));
+        REQUIRE_THAT(app, HasMemory(1, 0));
+        REQUIRE_THAT(app, HasMemory(2, 64));
+        REQUIRE_THAT(app, HasMemory(3, 96));
+    }
+
+    SECTION("clear loops")
+    {
+        auto app = CreateInterpreter("+++++[-]>++[+]+++>-[-]--");
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(2));
+        REQUIRE_THAT(app, HasMemory(0, 0));
+        REQUIRE_THAT(app, HasMemory(1, 3));
+        REQUIRE_THAT(app, HasMemory(2, -2));
+    }
+
+    SECTION("multiply loops")
+    {
+        // The first loop never runs and would move left of the first cell if it did.
+        auto app = CreateInterpreter("[-<+>]+++[->++>+<<]>>>--[+<+>]");
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(3));
+        REQUIRE_THAT(app, HasMemory(0, 0));
+        REQUIRE_THAT(app, HasMemory(1, 6));
+        REQUIRE_THAT(app, HasMemory(2, 5));
+        REQUIRE_THAT(app, HasMemory(3, 0));
+    }
+
+    SECTION("closed form loops")
+    {
+        const std::string multiply = "[->[->+>+<<]>>[-<<+>>]<<<]";
+
+        auto app = CreateInterpreter("+++++>+++++++<" + multiply);
+        RunWithEngine(app, engine);
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(0));
+        REQUIRE_THAT(app, HasMemory(0, 0));
+        REQUIRE_THAT(app, HasMemory(1, 7));
+        REQUIRE_THAT(app, HasMemory(2, 35));
+        REQUIRE_THAT(app, HasMemory(3, 0));
+
+        // 100 * 3 wraps around to 44.
+        auto wrapped = CreateInterpreter(std::string(100, '+') + ">+++<" + multiply);
+        RunWithEngine(wrapped, engine);
+        REQUIRE_THAT(wrapped, HasMemory(2, 44));
+
+        // A loop that counts up from -4 runs 4 times.
+        auto countUp = CreateInterpreter("---->+++<[+>[->+>+<<]>>[-<<+>>]<<<]");
+        RunWithEngine(countUp, engine);
+        REQUIRE_THAT(countUp, HasMemory(0, 0));
+        REQUIRE_THAT(countUp, HasMemory(2, 12));
+    }
+
+    SECTION("scan loops")
+    {
+        // Fill cells 1 to 40 so the scans cross several vector blocks before reaching a zero cell.
+        std::string program = ">";
+
+        for (int i = 0; i < 40; ++i)
+        {
+            program += "+>";
+        }
+
+        auto app = CreateInterpreter(program + "<[<]>[>]<<[<<<]>>>>>>[>>>>>>>]");
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(41));
+        REQUIRE_THAT(app, HasMemory(40, 1));
+    }
+
+    SECTION("print strings")
+    {
+        // The first loop is never entered so the text is known at compile time. The last write is of a read cell.
+        auto app = CreateInterpreter("[.]++++++++[>++++++++<-]>+.+.+.+.,.");
+        REQUIRE("ABCDx" == RunWithEngine(app, engine, "x"));
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(1));
+    }
+
+    SECTION("loops that run at most once")
+    {
+        // The third loop tests a cell two to the right of the memory pointer, and the last loop is skipped.
+        auto app = CreateInterpreter("++>+<[>>+++<<[-]>[-]<]>>[<+>[-]]>[-]+<<<[>+<[-]]");
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(0));
+        REQUIRE_THAT(app, HasMemory(0, 0));
+        REQUIRE_THAT(app, HasMemory(1, 1));
+        REQUIRE_THAT(app, HasMemory(2, 0));
+        REQUIRE_THAT(app, HasMemory(3, 1));
+    }
+
+    SECTION("jumps that were not precalculated by the compiler")
+    {
+        auto instructions = Compile(
+            "+++[>++<-]>[-]+>+[<+>[-]]",
+            [](Compiler& c) { c.setPrecalculateJumpOffsetsEnabled(false); });
+        Interpreter app(instructions);
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(2));
+        REQUIRE_THAT(app, HasMemory(0, 0));
+        REQUIRE_THAT(app, HasMemory(1, 2));
+        REQUIRE_THAT(app, HasMemory(2, 0));
+    }
+}
+
+TEST_CASE("console exceptions propagate out of execution engines with pointers synced", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+
+    auto app = CreateInterpreter(">>+++[.-]");
+    app.setConsole(std::make_unique<TestableConsole>(
+        []() { return (char)0; },
+        [](char c) { if (c == 2) { throw std::runtime_error("write failed"); } }));
+    app.setExecutionEngine(engine);
+
+    REQUIRE_THROWS_WITH(app.run(), "write failed");
+    REQUIRE_THAT(app.instructionPointer(), InstructionPointerIs(4));
+    REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(2));
+    REQUIRE_THAT(app, HasMemory(2, 2));
+}
+
+TEST_CASE("scans that move past the edge of memory throw with pointers synced", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+
+    SECTION("to the left")
+    {
+        auto app = CreateInterpreter(">>+<+[<<]");
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Scan moved the memory pointer past the start of memory");
+        REQUIRE_THAT(app.instructionPointer(), InstructionPointerIs(4));
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(1));
+    }
+
+    SECTION("to the right")
+    {
+        auto app = CreateInterpreter("+>+>+>+<<<[>]");
+        app.setCellCount(4);
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Scan moved the memory pointer past the end of memory");
+        REQUIRE_THAT(app.instructionPointer(), InstructionPointerIs(5));
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(0));
+    }
+}
+
+TEST_CASE("cells touched at an offset outside of memory throw with pointers synced", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+
+    // The block after the read touches the cell after the end of memory through an offset, so the check at the start
+    // of the block throws before any of it runs.
+    auto app = CreateInterpreter("," + std::string(15, '>') + ">+<.");
+    app.setCellCount(16);
+    app.setExecutionEngine(engine);
+
+    REQUIRE_THROWS_WITH(app.run(), "Memory pointer moved past the end of memory");
+    REQUIRE_THAT(app.instructionPointer(), InstructionPointerIs(1));
+    REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(0));
+    REQUIRE_THAT(app, HasMemory(16 - 1, 0));
+}
+
+TEST_CASE("touching memory outside of the tape throws", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+
+    SECTION("before the start")
+    {
+        auto app = CreateInterpreter("+<+");
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Memory pointer moved past the start of memory");
+    }
+
+    SECTION("past the end")
+    {
+        auto app = CreateInterpreter("+[>+]");
+        app.setCellCount(16);
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Memory pointer moved past the end of memory");
+    }
+
+    SECTION("past the end by one cell")
+    {
+        auto app = CreateInterpreter(std::string(30000, '>') + "+");
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Memory pointer moved past the end of memory");
+    }
+
+    SECTION("by touching the cell one past the end without moving there")
+    {
+        // The memory pointer stays on the last cell and the cell after it is touched through an offset.
+        auto app = CreateInterpreter(std::string(15, '>') + ">+<.");
+        app.setCellCount(16);
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Memory pointer moved past the end of memory");
+    }
+
+    SECTION("by touching the cell one before the start without moving there")
+    {
+        auto app = CreateInterpreter("<+>.");
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Memory pointer moved past the start of memory");
+    }
+
+    SECTION("by moving the pointer past the start")
+    {
+        // The cells touched are inside memory, and only the move at the end of the block leaves it.
+        auto app = CreateInterpreter("+>>+<<<");
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Memory pointer moved past the start of memory");
+        REQUIRE_THAT(app.instructionPointer(), InstructionPointerIs(3));
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(0));
+    }
+
+    SECTION("by moving the pointer further than a guard region without touching memory")
+    {
+        auto app = CreateInterpreter(std::string(3 * 1024 * 1024, '>') + "+");
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Memory pointer moved past the end of memory");
+        REQUIRE_THAT(app.instructionPointer(), InstructionPointerIs(0));
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(0));
+    }
+
+    SECTION("does not stop later programs")
+    {
+        auto failed = CreateInterpreter("<+");
+        failed.setExecutionEngine(engine);
+        REQUIRE_THROWS(failed.run());
+
+        auto app = CreateInterpreter("+>++");
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app, HasMemory(0, 1));
+        REQUIRE_THAT(app, HasMemory(1, 2));
+    }
+}
+
+TEST_CASE("optimized programs print what unoptimized ones do before a memory error", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+
+    // Offset addressing moves writes ahead of the pointer moves between them, and the output they fold into must not
+    // print anything the program would not have before it failed.
+    auto code = GENERATE(
+        std::string("+.>++.") + std::string(8, '>') + "+++.",
+        std::string("><+<.>."),
+        std::string("+.<[>].."),
+        std::string("++.>+.<<+.>."));
+
+    auto outputBeforeError = [&](int level) {
+        Compiler compiler;
+        compiler.setOptimizationLevel(level);
+
+        std::string output;
+        Interpreter app(
+            compiler.compile(code),
+            std::make_unique<TestableConsole>([]() { return (char)0; }, [&output](char c) { output.append(1, c); }));
+        app.setCellCount(8);
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS(app.run());
+        return output;
+    };
+
+    REQUIRE(outputBeforeError(0) == outputBeforeError(2));
+}
+
+TEST_CASE("large tapes are allocated without touching every cell", "[engines]")
+{
+    auto app = CreateInterpreter("+>++");
+    app.setCellCount(std::size_t{ 1 } << 30);
+    app.run();
+
+    REQUIRE_THAT(app, HasMemory(1, 2));
+    REQUIRE(0 == app.memoryAt(app.cellCount() - 1));
+}
+
+TEST_CASE("tape mode and memory limit can only be changed before running", "[engines]")
+{
+    auto app = CreateInterpreter("+");
+    app.setTapeMode(Interpreter::TapeMode::Growing);
+    app.setMaxMemory(4096);
+    REQUIRE(Interpreter::TapeMode::Growing == app.tapeMode());
+    REQUIRE(4096 == app.maxMemory());
+    REQUIRE_THROWS(app.setMaxMemory(0));
+
+    app.run();
+    REQUIRE_THROWS(app.setTapeMode(Interpreter::TapeMode::Fixed));
+    REQUIRE_THROWS(app.setMaxMemory(8192));
+}
+
+TEST_CASE("growing tapes extend in both directions as memory is touched", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+
+    SECTION("cells left of the first cell")
+    {
+        auto app = CreateInterpreter("<<<<<+++[->>>>>++<<<<<]>>>>>");
+        app.setTapeMode(Interpreter::TapeMode::Growing);
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(0));
+        REQUIRE_THAT(app, HasMemory(0, 6));
+    }
+
+    SECTION("cells far past the default cell count")
+    {
+        auto app = CreateInterpreter(std::string(100000, '>') + "+++");
+        app.setTapeMode(Interpreter::TapeMode::Growing);
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(100000));
+        REQUIRE_THAT(app, HasMemory(100000, 3));
+        REQUIRE(0 == app.memoryAt(99999));
+    }
+
+    SECTION("past the memory limit to the right")
+    {
+        auto app = CreateInterpreter("+[>+]");
+        app.setTapeMode(Interpreter::TapeMode::Growing);
+        app.setMaxMemory(128 * 1024);
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Memory limit exceeded");
+    }
+
+    SECTION("past the memory limit to the left")
+    {
+        auto app = CreateInterpreter("+[<+]");
+        app.setTapeMode(Interpreter::TapeMode::Growing);
+        app.setMaxMemory(128 * 1024);
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Memory limit exceeded");
+    }
+}
+
+TEST_CASE("sparse tapes only commit the pages that are touched", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+
+    SECTION("cells far apart")
+    {
+        auto app = CreateInterpreter(std::string(1000000, '>') + "+" + std::string(1000000, '>') + "++");
+        app.setTapeMode(Interpreter::TapeMode::Sparse);
+        app.setCellCount(100000000);
+        app.setMaxMemory(64 * 1024);
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(2000000));
+        REQUIRE_THAT(app, HasMemory(1000000, 1));
+        REQUIRE_THAT(app, HasMemory(2000000, 2));
+        REQUIRE(0 == app.memoryAt(50000000));
+    }
+
+    SECTION("past the memory limit")
+    {
+        auto app = CreateInterpreter("+[>+]");
+        app.setTapeMode(Interpreter::TapeMode::Sparse);
+        app.setCellCount(1000000);
+        app.setMaxMemory(64 * 1024);
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Memory limit exceeded");
+    }
+
+    SECTION("through console I/O without touching pages that are not committed")
+    {
+        // Untouched cells print as zero, and a cell that input is read into is committed before the read.
+        auto app = CreateInterpreter(std::string(1000000, '>') + "." + std::string(1000000, '>') + ",");
+        app.setTapeMode(Interpreter::TapeMode::Sparse);
+        app.setCellCount(100000000);
+        app.setMaxMemory(64 * 1024);
+
+        REQUIRE(std::string(1, '\0') == RunWithEngine(app, engine, "\x07"));
+        REQUIRE_THAT(app, HasMemory(2000000, 7));
+    }
+
+    SECTION("past the memory limit through console I/O")
+    {
+        auto app = CreateInterpreter("+[" + std::string(4096, '>') + ",]");
+        app.setConsole(std::make_unique<TestableConsole>([]() { return (char)1; }, [](char) {}));
+        app.setTapeMode(Interpreter::TapeMode::Sparse);
+        app.setCellCount(1000000);
+        app.setMaxMemory(64 * 1024);
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Memory limit exceeded");
+    }
+
+    SECTION("past the end")
+    {
+        auto app = CreateInterpreter("+[>+]");
+        app.setTapeMode(Interpreter::TapeMode::Sparse);
+        app.setCellCount(16);
+        app.setExecutionEngine(engine);
+
+        REQUIRE_THROWS_WITH(app.run(), "Memory pointer moved past the end of memory");
+    }
+}
+
+TEST_CASE("execution engines write runs of consecutive writes as one block", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+
+    // Offset addressing turns .>.>. into three writes with no pointer moves between them.
+    std::string output;
+    auto console = std::make_unique<TestableConsole>(
+        []() { return (char)0; },
+        [&output](char c) { output.append(1, c); });
+    auto consolePtr = console.get();
+
+    auto app = CreateInterpreter("+++++++++[>++++++++>+++++++++>++++++++++<<<-]>.>.>.");
+    app.setConsole(std::move(console));
+    app.setExecutionEngine(engine);
+    app.run();
+
+    REQUIRE("HQZ" == output);
+    REQUIRE(1u == consolePtr->writeBlockCount());
+}
+
+TEST_CASE("console block reads and writes fall back to single bytes by default", "[engines]")
+{
+    class ByteConsole : public IConsole
+    {
+    public:
+        virtual void write(char d) override { output.append(1, d); }
+        virtual char read() override { return position < input.size() ? input[position++] : (char)EOF; }
+
+        std::string input;
+        std::size_t position = 0;
+        std::string output;
+    };
+
+    ByteConsole console;
+    console.input = "ab";
+
+    console.writeBlock("xyz", 3);
+    REQUIRE("xyz" == console.output);
+
+    // Reads stop early at the end of input.
+    char buffer[3] = {};
+    REQUIRE(2u == console.readBlock(buffer, 3));
+    REQUIRE('a' == buffer[0]);
+    REQUIRE('b' == buffer[1]);
+    REQUIRE(0u == console.readBlock(buffer, 3));
+}
+
+TEST_CASE("execution engines run far jumps", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+
+    // Alternating + and - are not merged when cancelling runs is disabled so the loop bodies are too long for near
+    // jumps. The outer loop runs three times and the inner loop is always skipped.
+    std::string body;
+
+    for (int i = 0; i < 20000; ++i)
+    {
+        body += ">+-<";
+    }
+
+    auto keepRuns = [](Compiler& c) { c.setPassEnabled(CompilerPass::CancelRuns, false); };
+
+    SECTION("in loops")
+    {
+        Interpreter app(Compile("+++[" + body + ">+<>>[" + body + "]<<-]>.", keepRuns));
+        REQUIRE("\x03" == RunWithEngine(app, engine));
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(1));
+        REQUIRE_THAT(app, HasMemory(0, 0));
+        REQUIRE_THAT(app, HasMemory(1, 3));
+    }
+
+    SECTION("in loops that run at most once")
+    {
+        // The body is too long for the distance to the EndIf to fit in the IfZeroSkip so it is a far IfZeroSkip.
+        Interpreter app(Compile("+[" + body + ">+<[-]]>[" + body + "[-]]>+.", keepRuns));
+        REQUIRE("\x01" == RunWithEngine(app, engine));
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(2));
+        REQUIRE_THAT(app, HasMemory(0, 0));
+        REQUIRE_THAT(app, HasMemory(1, 0));
+        REQUIRE_THAT(app, HasMemory(2, 1));
+    }
+}
+
+TEST_CASE("execution engines skip far IfZeroSkip bodies holding far jumps", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+
+    // The extension words of the inner far loop hold distances whose low bytes used to be mistaken for jumps when
+    // searching for the end of the outer IfZeroSkip.
+    auto count = GENERATE(16515, 16521);
+    std::string body;
+
+    for (int i = 0; i < count; ++i)
+    {
+        body += "+>+<";
+    }
+
+    Interpreter app(Compile(",>,<[>[" + body + "-]<[-]]>>++++++++[>++++++++<-]>+."));
+    REQUIRE("A" == RunWithEngine(app, engine, std::string(2, '\0')));
+}
+
+TEST_CASE("execution engines follow far jumps longer than an extension word", "[engines]")
+{
+    // The inner loop is always skipped so the body never runs, and the outer loop jumps back over it once.
+    std::string body(instruction_t::MaxExtensionValue + 9, '\0');
+
+    for (size_t i = 0; i < body.size(); i += 2)
+    {
+        body[i] = '+';
+        body[i + 1] = '-';
+    }
+
+    auto program = std::make_shared<const Program>(Compile("++[>[" + body + "]<-]>>+", [](Compiler& c) {
+        c.setOptimizationLevel(0);
+        c.setPrecalculateJumpOffsetsEnabled(true);
+    }));
+
+    // Native code matches jumps by nesting and never reads the distance, and compiling this much of it is slow. The
+    // program is large so it is compiled once and shared.
+    for (auto engine : { Interpreter::ExecutionEngine::Basic, Interpreter::ExecutionEngine::Threaded })
+    {
+        Interpreter app(program);
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app, HasMemory(0, 0));
+        REQUIRE_THAT(app, HasMemory(2, 1));
+    }
+}
+
+TEST_CASE("execution engines run partially evaluated programs", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+    auto budget = GENERATE(1, 5, 1000);
+
+    auto instructions = Compile(
+        "++++++++[>++++++++<-]>+.+.,.>+++[>+++<-]>.",
+        [budget](Compiler& c) {
+            c.setPartialEvaluationEnabled(true);
+            c.setPartialEvaluationBudget(budget);
+        });
+    Interpreter app(instructions);
+
+    REQUIRE("ABx\x09" == RunWithEngine(app, engine, "x"));
+    REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(3));
+    REQUIRE_THAT(app, HasMemory(0, 0));
+    REQUIRE_THAT(app, HasMemory(1, 'x'));
+    REQUIRE_THAT(app, HasMemory(2, 0));
+    REQUIRE_THAT(app, HasMemory(3, 9));
+}
+
+TEST_CASE("execution engines run programs with cells wider than a byte", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+    auto cellSize = GENERATE(as<size_t>{}, 2, 4, 8);
+
+    Compiler compiler;
+    compiler.setCellSize(cellSize);
+
+    SECTION("arithmetic past 255")
+    {
+        Interpreter app(compiler.compile(std::string(300, '+') + ">-"));
+        app.setCellSize(cellSize);
+        RunWithEngine(app, engine);
+
+        REQUIRE(300 == app.cellAt(0));
+        REQUIRE(-1 == app.cellAt(1));
+        REQUIRE_THAT(app, HasMemory(0, 44));
+    }
+
+    SECTION("multiply loops and writes of the lowest byte")
+    {
+        Interpreter app(compiler.compile("++++++++++++++++[->++++++++++++++++<]>+.[->>+<<]"));
+        app.setCellSize(cellSize);
+
+        REQUIRE("\x01" == RunWithEngine(app, engine));
+        REQUIRE(0 == app.cellAt(1));
+        REQUIRE(257 == app.cellAt(3));
+    }
+
+    SECTION("scans that stop on cells that are only zero in their lowest byte")
+    {
+        Interpreter app(compiler.compile(">" + std::string(256, '+') + ">+[<]"));
+        app.setCellSize(cellSize);
+        RunWithEngine(app, engine);
+
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(0));
+    }
+
+    SECTION("reads of bytes above 127")
+    {
+        Interpreter app(compiler.compile(",>,"));
+        app.setCellSize(cellSize);
+        RunWithEngine(app, engine, "\xE9\x41");
+
+        REQUIRE(0xE9 == app.cellAt(0));
+        REQUIRE(0x41 == app.cellAt(1));
+    }
+}
+
+TEST_CASE("reads at the end of input follow the end of stream behavior", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+    auto behavior = GENERATE(
+        Interpreter::EndOfStreamBehavior::Zero,
+        Interpreter::EndOfStreamBehavior::NegativeOne,
+        Interpreter::EndOfStreamBehavior::NoChange);
+
+    auto app = CreateInterpreter("+++,", []() { return static_cast<Interpreter::byte_t>(EOF); }, [](auto) {});
+    app.setEndOfStreamBehavior(behavior);
+    app.setExecutionEngine(engine);
+    app.run();
+
+    switch (behavior)
+    {
+    case Interpreter::EndOfStreamBehavior::Zero:
+        REQUIRE_THAT(app, HasMemory(0, 0));
+        break;
+
+    case Interpreter::EndOfStreamBehavior::NegativeOne:
+        REQUIRE_THAT(app, HasMemory(0, -1));
+        break;
+
+    default:
+        REQUIRE_THAT(app, HasMemory(0, 3));
+        break;
+    }
+}
+
+TEST_CASE("tier up threshold must be positive", "[engines]")
+{
+    auto app = CreateInterpreter("+");
+    REQUIRE_THROWS(app.setTierUpThreshold(0));
+
+    app.setTierUpThreshold(5);
+    REQUIRE(5 == app.tierUpThreshold());
+}
+
+TEST_CASE("tiered engine switches to native code for hot loops", "[engines]")
+{
+    auto threshold = GENERATE(1, 2, 3, 50);
+
+    SECTION("nested loops")
+    {
+        // Keep the inner loop as a loop rather than letting it be replaced with multiply instructions.
+        auto instructions = Compile(
+            "++++++++[>++++[>++>+++<<-]<-]>>",
+            [](Compiler& c) { c.setReplaceMultiplyLoopsEnabled(false); });
+        Interpreter app(instructions);
+        app.setTierUpThreshold(threshold);
+        RunWithEngine(app, Interpreter::ExecutionEngine::Tiered);
+
+        REQUIRE_THAT(app.instructionPointer(), InstructionPointerIs(16));
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(2));
+        REQUIRE_THAT(app, HasMemory(0, 0));
+        REQUIRE_THAT(app, HasMemory(1, 0));
+        REQUIRE_THAT(app, HasMemory(2, 64));
+        REQUIRE_THAT(app, HasMemory(3, 96));
+    }
+
+    SECTION("loops with input and output")
+    {
+        auto app = CreateInterpreter(",[.,]");
+        app.setTierUpThreshold(threshold);
+
+        REQUIRE("hello tiered world" == RunWithEngine(app, Interpreter::ExecutionEngine::Tiered, "hello tiered world"));
+    }
+
+    SECTION("console exceptions thrown from native loops")
+    {
+        auto app = CreateInterpreter("+[>+++++[.-]<]");
+        app.setTierUpThreshold(threshold);
+        app.setConsole(std::make_unique<TestableConsole>(
+            []() { return (char)0; },
+            [](char c) { if (c == 1) { throw std::runtime_error("write failed"); } }));
+        app.setExecutionEngine(Interpreter::ExecutionEngine::Tiered);
+
+        REQUIRE_THROWS_WITH(app.run(), "write failed");
+        REQUIRE_THAT(app.instructionPointer(), InstructionPointerIs(6));
+        REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(1));
+        REQUIRE_THAT(app, HasMemory(1, 1));
+    }
+}
+
+TEST_CASE("interpreters share a compiled program", "[engines]")
+{
+    auto engine = GENERATE(
+        Interpreter::ExecutionEngine::Basic,
+        Interpreter::ExecutionEngine::Threaded,
+        Interpreter::ExecutionEngine::Jit,
+        Interpreter::ExecutionEngine::Tiered);
+
+    auto program = Compiler().compileProgram("++++++++[>++++++++<-],[>+.<-]");
+
+    SECTION("one after another")
+    {
+        Interpreter first(program);
+        Interpreter second(program);
+
+        REQUIRE("ABC" == RunWithEngine(first, engine, "\x03"));
+        REQUIRE("AB" == RunWithEngine(second, engine, "\x02"));
+        REQUIRE(first.program() == second.program());
+        REQUIRE_THAT(first, HasMemory(1, 67));
+        REQUIRE_THAT(second, HasMemory(1, 66));
+    }
+
+    SECTION("on different threads")
+    {
+        // Catch assertions are not thread safe, so each thread only records its output.
+        constexpr int ThreadCount = 4;
+        std::vector<std::string> outputs(ThreadCount);
+        std::vector<std::thread> threads;
+
+        for (int i = 0; i < ThreadCount; ++i)
+        {
+            threads.emplace_back([&, i]() {
+                Interpreter app(program);
+                app.setTierUpThreshold(1);
+                outputs[i] = RunWithEngine(app, engine, std::string(1, static_cast<char>(i + 1)));
+            });
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        REQUIRE("A" == outputs[0]);
+        REQUIRE("AB" == outputs[1]);
+        REQUIRE("ABC" == outputs[2]);
+        REQUIRE("ABCD" == outputs[3]);
+    }
+}
+
+TEST_CASE("interpreters start with the cell size and count a program was compiled for", "[engines]")
+{
+    Compiler compiler;
+    compiler.setCellSize(2);
+    compiler.setCellCount(64);
+
+    Interpreter app(compiler.compileProgram("+[+]"));
+    REQUIRE(2 == app.cellSize());
+    REQUIRE(64 == app.cellCount());
+    REQUIRE_THROWS(Interpreter(std::shared_ptr<const Program>()));
+}
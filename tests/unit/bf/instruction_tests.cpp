@@ -143,3 +143,58 @@ TEST_CASE("an instruction opcode can be changed after construction", "[instructi
     REQUIRE(32767 == instr.param());
     REQUIRE(OpcodeType::MemInc == instr.opcode());
 }
+
+TEST_CASE("an instruction offset is independent of the opcode and parameter", "[instructions]")
+{
+    instruction_t instr(OpcodeType::MulAdd, -32768, -128);
+    REQUIRE(OpcodeType::MulAdd == instr.opcode());
+    REQUIRE(-32768 == instr.param());
+    REQUIRE(-128 == instr.offset());
+
+    instr.setParam(-1);
+    REQUIRE(-1 == instr.param());
+    REQUIRE(-128 == instr.offset());
+
+    instr.setOffset(127);
+    REQUIRE(OpcodeType::MulAdd == instr.opcode());
+    REQUIRE(-1 == instr.param());
+    REQUIRE(127 == instr.offset());
+}
+
+TEST_CASE("print string data words hold text bytes and are no-ops", "[instructions]")
+{
+    auto word = instruction_t::stringData("a\xFFzq", 4);
+    REQUIRE(OpcodeType::NoOperation == word.opcode());
+    REQUIRE('a' == word.stringByte(0));
+    REQUIRE('\xFF' == word.stringByte(1));
+    REQUIRE('z' == word.stringByte(2));
+
+    REQUIRE(0u == instruction_t::stringDataWordCount(0));
+    REQUIRE(1u == instruction_t::stringDataWordCount(3));
+    REQUIRE(2u == instruction_t::stringDataWordCount(4));
+}
+
+TEST_CASE("extension words have their own opcode and hold a 24 bit value", "[instructions]")
+{
+    // The low byte of these values matches jump opcodes, which must not leak into the extension word's opcode.
+    for (uint32_t value : { 0u, 9u, 0x0A0Au, 0x123415u, instruction_t::MaxExtensionValue })
+    {
+        auto word = instruction_t::extension(value);
+        REQUIRE(OpcodeType::Extension == word.opcode());
+        REQUIRE(value == word.extensionValue());
+    }
+}
+
+TEST_CASE("far jumps split their distance with the extension word after them", "[instructions]")
+{
+    const uint64_t distances[] = { 0x8000, 0xFFFFFF, 0x1000000, 0x12345678, instruction_t::MaxFarDistance };
+
+    for (auto distance : distances)
+    {
+        auto [jump, extension] = instruction_t::farJump(OpcodeType::FarIfZeroSkip, distance, -3);
+        REQUIRE(OpcodeType::FarIfZeroSkip == jump.opcode());
+        REQUIRE(-3 == jump.offset());
+        REQUIRE(OpcodeType::Extension == extension.opcode());
+        REQUIRE(distance == jump.farDistance(extension));
+    }
+}
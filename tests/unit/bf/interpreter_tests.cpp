@@ -183,3 +183,24 @@ TEST_CASE("] jumps to [ if current byte is not zero", "[interpreter]")
     REQUIRE(0 == app.memoryAt(0));
     REQUIRE(1 == app.memoryAt(1));
 }
+
+TEST_CASE("clear loops set the current cell to zero", "[interpreter]")
+{
+    auto app = CreateInterpreter(std::string("+++++[-]>++[+]>-[-]"));
+    app.run();
+
+    REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(2));
+    REQUIRE(0 == app.memoryAt(0));
+    REQUIRE(0 == app.memoryAt(1));
+    REQUIRE(0 == app.memoryAt(2));
+}
+
+TEST_CASE("clear loops followed by an adjustment set the current cell to a value", "[interpreter]")
+{
+    auto app = CreateInterpreter(std::string("+++++[-]+++>++[-]--"));
+    app.run();
+
+    REQUIRE_THAT(app.memoryPointer(), MemoryPointerIs(1));
+    REQUIRE(3 == app.memoryAt(0));
+    REQUIRE(-2 == app.memoryAt(1));
+}
@@ -1,5 +1,6 @@
 #include "testhelpers.h"
 #include "bf/helpers.h"
+#include <cstdio>
 #include <sstream>
 #include <string>
 
@@ -132,7 +133,12 @@ std::vector<instruction_t> Brainfreeze::TestHelpers::Compile(
     std::function<void(Compiler&)>&& configureCallback)
 {
     Compiler compiler;
-    
+
+    // Most tests compile fragments like [-] or + that would be removed or folded into stores at the start of a
+    // program where every cell is known to be zero, so those passes only run when a test enables them.
+    compiler.setPassEnabled(CompilerPass::DeadLoops, false);
+    compiler.setPassEnabled(CompilerPass::ConstantPropagation, false);
+
     if (configureCallback != nullptr)
     {
         configureCallback(compiler);
@@ -223,6 +229,35 @@ char TestableConsole::read()
     return readFunction_();
 }
 
+//---------------------------------------------------------------------------------------------------------------------
+void TestableConsole::writeBlock(const char* data, std::size_t size)
+{
+    writeBlockCount_++;
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        writeFunction_(data[i]);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+std::size_t TestableConsole::readBlock(char* buffer, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        auto c = readFunction_();
+
+        if (c == EOF)
+        {
+            return i;
+        }
+
+        buffer[i] = c;
+    }
+
+    return size;
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 std::function<char(void)> TestableConsole::readFunction() const
 {
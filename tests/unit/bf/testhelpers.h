@@ -71,6 +71,11 @@ namespace Brainfreeze
 
             virtual void write(char d) override;
             virtual char read() override;
+            virtual void writeBlock(const char* data, std::size_t size) override;
+            virtual std::size_t readBlock(char* buffer, std::size_t size) override;
+
+            /** Get the number of times a block of bytes was written. */
+            std::size_t writeBlockCount() const noexcept { return writeBlockCount_; }
 
             std::function<char(void)> readFunction() const;
             void setReadFunction(std::function<char(void)> func);
@@ -81,6 +86,7 @@ namespace Brainfreeze
         private:
             std::function<char(void)> readFunction_;
             std::function<void(char)> writeFunction_;
+            std::size_t writeBlockCount_ = 0;
         };
     }
 